@@ -15,9 +15,44 @@ using namespace cv;
 
 class ICalibration{
 public:
+	ICalibration() : interpolation(INTER_LINEAR) {}
 	virtual ~ICalibration(){}
-    virtual void rectifyImage(Mat &src, Mat &dst) = 0;
-    Size imageSize;
+
+	// Rectifies a frame of any size as if it had first been resized to imageSize.
+	// The resize is folded into the maps, so the frame is read once by a single
+	// remap; the maps are built again only when the size of the frames changes.
+	void rectifyImage(const Mat &src, Mat &dst){
+		if (src.size() != mapInputSize || mapImageSize != imageSize) {
+			initRectifyMap(src.size(), map1, map2);
+			mapInputSize = src.size();
+			mapImageSize = imageSize;
+		}
+		remap(src, dst, map1, map2, interpolation, BORDER_CONSTANT);
+	}
+
+	// Maps (CV_16SC2 + CV_16UC1) of the rectification of frames of inputSize
+	void initRectifyMap(Size inputSize, Mat &map1, Mat &map2){
+		Mat mapx, mapy;
+		initRectifyMapFloat(mapx, mapy);
+		if (inputSize != imageSize) {
+			// resize samples the pixel centers: x in the frame is (x + 0.5) * sx - 0.5
+			double sx = (double) inputSize.width / imageSize.width, sy = (double) inputSize.height / imageSize.height;
+			mapx.convertTo(mapx, CV_32F, sx, 0.5 * sx - 0.5);
+			mapy.convertTo(mapy, CV_32F, sy, 0.5 * sy - 0.5);
+		}
+		convertMaps(mapx, mapy, map1, map2, CV_16SC2);
+	}
+
+	Size imageSize;
+	int interpolation;
+
+protected:
+	// CV_32FC1 maps from the rectified image to the image of imageSize
+	virtual void initRectifyMapFloat(Mat &mapx, Mat &mapy) = 0;
+
+private:
+	Mat map1, map2; // of rectifyImage, for frames of mapInputSize
+	Size mapInputSize, mapImageSize;
 };
 
 
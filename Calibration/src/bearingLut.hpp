@@ -0,0 +1,237 @@
+/*
+ * bearingLut.hpp
+ *
+ * Pixel to unit bearing vector lookup table of an omnidirectional camera.
+ */
+
+#ifndef SRC_BEARINGLUT_HPP_
+#define SRC_BEARINGLUT_HPP_
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cmath>
+#include <cstring>
+
+#include "omnidirExt.hpp"
+
+using namespace cv;
+using namespace std;
+
+// omnidir::undistortPoints iterates the distortion inversion for every point.
+// The table holds the exact bearings of a grid of nodes every `step` pixels,
+// built once from K, D and xi; a point is converted by the bilinear blend of
+// the bearings of the 4 nodes around it, renormalized to unit length. The
+// three components are stored in separate planes so that 4 points are blended
+// in one SIMD register per component.
+//
+// The table is saved to a binary sidecar of the calibration file holding the
+// model it was built from, so that a stale table is detected and rebuilt.
+class BearingLut {
+public:
+	BearingLut() : step(0), xi(0) {}
+
+	BearingLut(const Mat &K, const Mat &D, double xi, Size imageSize, int step) : step(0), xi(0) {
+		build(K, D, xi, imageSize, step);
+	}
+
+	void build(const Mat &K, const Mat &D, double xi, Size imageSize, int step) {
+		CV_Assert(step > 0 && imageSize.width > 1 && imageSize.height > 1);
+		K.convertTo(this->K, CV_64F);
+		D.reshape(1, 1).convertTo(this->D, CV_64F);
+		this->xi = xi;
+		this->imageSize = imageSize;
+		this->step = step;
+		gridSize = gridFor(imageSize, step);
+		int n = gridSize.area();
+		bx.assign(n, 0);
+		by.assign(n, 0);
+		bz.assign(n, 0);
+		parallel_for_(Range(0, gridSize.height), BuildBody(*this));
+	}
+
+	bool matches(const Mat &K, const Mat &D, double xi, Size imageSize, int step) const {
+		if (this->step != step || this->imageSize != imageSize || this->xi != xi)
+			return false;
+		Matx33d k;
+		Matx14d d;
+		K.convertTo(k, CV_64F);
+		D.reshape(1, 1).convertTo(d, CV_64F);
+		return k == this->K && d == this->D;
+	}
+
+	// Bearings of n points given as x/y arrays, written to the x/y/z arrays.
+	// Points outside of the image are clamped to its border.
+	void lookup(const float *px, const float *py, int n, float *ox, float *oy, float *oz) const {
+		CV_Assert(step > 0);
+		int i = 0;
+#if CV_SIMD128
+		const v_float32x4 inv = v_setall_f32(1.f / step), zero = v_setzero_f32(),
+				maxX = v_setall_f32((float) (imageSize.width - 1)), maxY = v_setall_f32((float) (imageSize.height - 1)),
+				one = v_setall_f32(1.f);
+		const v_int32x4 lastX = v_setall_s32(gridSize.width - 2), lastY = v_setall_s32(gridSize.height - 2);
+		int CV_DECL_ALIGNED(16) ix[4], iy[4];
+		float CV_DECL_ALIGNED(16) c[3][4][4]; // component, node, point
+		for (; i <= n - 4; i += 4) {
+			v_float32x4 gx = v_min(v_max(v_load(px + i), zero), maxX) * inv;
+			v_float32x4 gy = v_min(v_max(v_load(py + i), zero), maxY) * inv;
+			v_int32x4 x0 = v_min(v_floor(gx), lastX), y0 = v_min(v_floor(gy), lastY);
+			v_float32x4 fx = gx - v_cvt_f32(x0), fy = gy - v_cvt_f32(y0);
+			// the node index in int, a float one is inexact beyond 2^24 nodes
+			v_store(ix, x0);
+			v_store(iy, y0);
+			for (int k = 0; k < 4; k++) {
+				int w = gridSize.width, j = iy[k] * w + ix[k];
+				c[0][0][k] = bx[j]; c[0][1][k] = bx[j + 1]; c[0][2][k] = bx[j + w]; c[0][3][k] = bx[j + w + 1];
+				c[1][0][k] = by[j]; c[1][1][k] = by[j + 1]; c[1][2][k] = by[j + w]; c[1][3][k] = by[j + w + 1];
+				c[2][0][k] = bz[j]; c[2][1][k] = bz[j + 1]; c[2][2][k] = bz[j + w]; c[2][3][k] = bz[j + w + 1];
+			}
+			v_float32x4 w00 = (one - fx) * (one - fy), w01 = fx * (one - fy), w10 = (one - fx) * fy, w11 = fx * fy;
+			v_float32x4 b[3];
+			for (int m = 0; m < 3; m++)
+				b[m] = v_load(c[m][0]) * w00 + v_load(c[m][1]) * w01 + v_load(c[m][2]) * w10 + v_load(c[m][3]) * w11;
+			v_float32x4 s = v_invsqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+			v_store(ox + i, b[0] * s);
+			v_store(oy + i, b[1] * s);
+			v_store(oz + i, b[2] * s);
+		}
+#endif
+		for (; i < n; i++)
+			lookupOne(px[i], py[i], ox[i], oy[i], oz[i]);
+	}
+
+	void lookup(const vector<Point2f> &points, vector<Point3f> &bearings) const {
+		int n = (int) points.size();
+		vector<float> px(n), py(n), ox(n), oy(n), oz(n);
+		for (int i = 0; i < n; i++) {
+			px[i] = points[i].x;
+			py[i] = points[i].y;
+		}
+		if (n > 0)
+			lookup(&px[0], &py[0], n, &ox[0], &oy[0], &oz[0]);
+		bearings.resize(n);
+		for (int i = 0; i < n; i++)
+			bearings[i] = Point3f(ox[i], oy[i], oz[i]);
+	}
+
+	bool save(const string &filename) const {
+		ofstream file(filename.c_str(), ios::binary);
+		if (!file)
+			return false;
+		int header[6] = { magic, imageSize.width, imageSize.height, step, gridSize.width, gridSize.height };
+		file.write((const char*) header, sizeof(header));
+		file.write((const char*) K.val, sizeof(K.val));
+		file.write((const char*) D.val, sizeof(D.val));
+		file.write((const char*) &xi, sizeof(xi));
+		file.write((const char*) &bx[0], bx.size() * sizeof(float));
+		file.write((const char*) &by[0], by.size() * sizeof(float));
+		file.write((const char*) &bz[0], bz.size() * sizeof(float));
+		return (bool) file;
+	}
+
+	// Fails, leaving the table empty, if the file is not a table of this format, if
+	// its header is inconsistent with its size, or if it was built for images of
+	// another size than expectedSize, when given
+	bool load(const string &filename, Size expectedSize = Size()) {
+		step = 0;
+		ifstream file(filename.c_str(), ios::binary);
+		int header[6];
+		if (!file.read((char*) header, sizeof(header)) || header[0] != magic)
+			return false;
+		Size size(header[1], header[2]), grid(header[4], header[5]);
+		int nodeStep = header[3];
+		if (size.width <= 1 || size.height <= 1 || size.width > maxSide || size.height > maxSide
+				|| nodeStep <= 0 || grid != gridFor(size, nodeStep))
+			return false;
+		if (expectedSize.area() > 0 && size != expectedSize)
+			return false;
+		// the nodes must all be there before anything is allocated
+		size_t n = (size_t) grid.area(), expected = sizeof(header) + sizeof(K.val) + sizeof(D.val) + sizeof(xi)
+				+ 3 * n * sizeof(float);
+		streampos start = file.tellg();
+		file.seekg(0, ios::end);
+		if (!file || (size_t) file.tellg() != expected)
+			return false;
+		file.seekg(start);
+		file.read((char*) K.val, sizeof(K.val));
+		file.read((char*) D.val, sizeof(D.val));
+		file.read((char*) &xi, sizeof(xi));
+		bx.resize(n);
+		by.resize(n);
+		bz.resize(n);
+		file.read((char*) &bx[0], n * sizeof(float));
+		file.read((char*) &by[0], n * sizeof(float));
+		file.read((char*) &bz[0], n * sizeof(float));
+		if (!file)
+			return false;
+		imageSize = size;
+		gridSize = grid;
+		step = nodeStep;
+		return true;
+	}
+
+	Size imageSize;
+	int step;      // pixels between two nodes
+	Size gridSize; // nodes per row and per column
+
+private:
+	enum { magic = 0x54554c42 }; // "BLUT"
+	enum { maxSide = 1 << 15 };  // largest image side accepted from a file, node indices fit in an int
+
+	// the last node is at or beyond the last pixel so that every pixel has 4 nodes around it
+	static Size gridFor(Size imageSize, int step) {
+		return Size((imageSize.width - 1 + step - 1) / step + 1, (imageSize.height - 1 + step - 1) / step + 1);
+	}
+
+	void lookupOne(float x, float y, float &ox, float &oy, float &oz) const {
+		float gx = std::min(std::max(x, 0.f), (float) (imageSize.width - 1)) / step;
+		float gy = std::min(std::max(y, 0.f), (float) (imageSize.height - 1)) / step;
+		int x0 = std::min((int) gx, gridSize.width - 2), y0 = std::min((int) gy, gridSize.height - 2);
+		float fx = gx - x0, fy = gy - y0;
+		int j = y0 * gridSize.width + x0, w = gridSize.width;
+		float w00 = (1 - fx) * (1 - fy), w01 = fx * (1 - fy), w10 = (1 - fx) * fy, w11 = fx * fy;
+		float b0 = bx[j] * w00 + bx[j + 1] * w01 + bx[j + w] * w10 + bx[j + w + 1] * w11;
+		float b1 = by[j] * w00 + by[j + 1] * w01 + by[j + w] * w10 + by[j + w + 1] * w11;
+		float b2 = bz[j] * w00 + bz[j + 1] * w01 + bz[j + w] * w10 + bz[j + w + 1] * w11;
+		float s = 1.f / std::sqrt(b0 * b0 + b1 * b1 + b2 * b2);
+		ox = b0 * s;
+		oy = b1 * s;
+		oz = b2 * s;
+	}
+
+	// Exact bearings of the nodes, one grid row per iteration
+	class BuildBody: public ParallelLoopBody {
+	public:
+		BuildBody(BearingLut &lut) : lut(lut) {
+		}
+
+		void operator()(const Range &range) const {
+			Mat nodes(lut.gridSize.width, 1, CV_64FC2), bearings;
+			for (int r = range.start; r < range.end; r++) {
+				for (int c = 0; c < lut.gridSize.width; c++)
+					nodes.at<Vec2d>(c) = Vec2d(c * lut.step, r * lut.step);
+				omnidir::imagePointsToBearings(nodes, bearings, lut.K, lut.D, lut.xi);
+				for (int c = 0; c < lut.gridSize.width; c++) {
+					Vec3d b = bearings.at<Vec3d>(c);
+					int j = r * lut.gridSize.width + c;
+					lut.bx[j] = (float) b[0];
+					lut.by[j] = (float) b[1];
+					lut.bz[j] = (float) b[2];
+				}
+			}
+		}
+
+	private:
+		BearingLut &lut;
+	};
+
+	Matx33d K;
+	Matx14d D;
+	double xi;
+	vector<float> bx, by, bz; // node bearings, gridSize.height rows of gridSize.width
+};
+
+#endif /* SRC_BEARINGLUT_HPP_ */
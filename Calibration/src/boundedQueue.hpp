@@ -0,0 +1,75 @@
+/*
+ * boundedQueue.hpp
+ *
+ * Blocking FIFO of bounded capacity between the stages of a pipeline.
+ */
+
+#ifndef SRC_BOUNDEDQUEUE_HPP_
+#define SRC_BOUNDEDQUEUE_HPP_
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+// push() waits while the queue is full, pop() while it is empty. Once close()
+// is called the producers are released and the consumers drain what is left,
+// then pop() returns false.
+template<typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+	// Returns false if the queue was closed, the item is then dropped
+	bool push(T item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+		if (closed)
+			return false;
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	// Returns false without waiting if the queue is full or closed, the item is then dropped
+	bool tryPush(T item) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (closed || items.size() >= capacity)
+			return false;
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+		return true;
+	}
+
+	// Returns false once the queue is closed and empty
+	bool pop(T &item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+		if (items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notFull.notify_all();
+		notEmpty.notify_all();
+	}
+
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return items.size();
+	}
+
+private:
+	const size_t capacity;
+	bool closed;
+	std::deque<T> items;
+	mutable std::mutex mutex;
+	std::condition_variable notFull, notEmpty;
+};
+
+#endif /* SRC_BOUNDEDQUEUE_HPP_ */
@@ -5,6 +5,7 @@
  *      Author: miaou51914
  */
 
+#include "omnidir.cpp"
 #include "opencv2/opencv.hpp"
 #include <docopt.cpp/docopt.h>
 
@@ -12,17 +13,33 @@
 #include "cmosCalibration.hpp"
 #include "omniCalibration.hpp"
 #include "imageSource.hpp"
-#include <unistd.h>
+#include "snapshotWriter.hpp"
+#include "liveCalibration.hpp"
+#include "frameContext.hpp"
 
 static const char USAGE[] =
 		R"(camCapture.
 
     Usage:
-      camCapture (vc|v4l) <cameraId> [(cmos|omni) <calib.xml>] [--width=<width> --height=<height>]
+      camCapture (vc|v4l) <cameraId> [(cmos|omni) <calib.xml>] [options]
+      camCapture replay <pattern> [(cmos|omni) <calib.xml>] [options]
+      camCapture synthetic (chessboard|mirror) [(cmos|omni) <calib.xml>] [options]
       camCapture (-h | --help)
 
     Options:
-      -h --help     Show this screen.
+      -h --help          Show this screen.
+      --width=<width>    Width of the frames without calibration [default: 1280].
+      --height=<height>  Height of the frames without calibration [default: 960].
+      --fps=<fps>        Rate of the replayed or synthetic frames, 0 as fast as possible, -1 the recorded rate [default: 0].
+      --frames=<n>       Stop after n frames, every one processed, and print the frame rate [default: 0].
+      --no-display       Rectify the frames without showing them, to measure the processing alone.
+      --format=<format>  Format of the snapshots taken with 'a': bmp, png, tiff or raw [default: bmp].
+      --png-compression=<level>  Compression level of the png snapshots, 0 to 9 [default: 3].
+      --burst=<n>        Consecutive frames saved by each snapshot, at the camera rate [default: 1].
+      --live             Calibrate the omnidirectional model during the capture, from the board views.
+      --board=<size>     Inner corners of the board for --live [default: 9x6].
+      --square=<size>    Side of the board squares for --live [default: 17.5].
+      --live-output=<calib.xml>  Model written by --live after each calibration [default: live_camera_omni.xml].
 )";
 
 using namespace cv;
@@ -31,6 +48,7 @@ int main(int argc, char** argv) {
 	std::map<std::string, docopt::value> args = docopt::docopt(USAGE,
 			{ argv + 1, argv + argc }, true,           // show help if requested
 			"0.1");  // version string
+	AllocationReport allocations; // counts from here on, the capture thread included
 
 	//Read calibration settings
 	ICalibration *s = NULL;
@@ -56,46 +74,143 @@ int main(int argc, char** argv) {
 		imageSource = new V4lImageSource(args["<cameraId>"].asLong(), CvSize(imageSize));
 	}
 
+	// hardware free sources, e.g. to measure the frame rate
+	double fps = stod(args["--fps"].asString());
+	if(args["replay"].asBool()){
+		imageSource = new ReplayImageSource(args["<pattern>"].asString(), fps);
+	}
+	if(args["synthetic"].asBool()){
+		imageSource = new SyntheticImageSource(imageSize,
+				args["mirror"].asBool() ? SyntheticImageSource::MIRROR : SyntheticImageSource::CHESSBOARD, fps);
+	}
+
+	// the display, the snapshots and the pauses below no longer hold the capture back;
+	// a measure over a number of frames processes them all
+	long maxFrames = args["--frames"].asLong();
+	bool display = !args["--no-display"].asBool();
+	AsyncImageSource *asyncSource = new AsyncImageSource(imageSource,
+			maxFrames > 0 ? AsyncImageSource::EVERY : AsyncImageSource::LATEST);
+	imageSource = asyncSource;
+
 
-	namedWindow( "stream", WINDOW_NORMAL);
-	resizeWindow("stream", imageSize.width , imageSize.height);
+	SnapshotWriter::Format format;
+	if(!SnapshotWriter::parseFormat(args["--format"].asString(), format)){
+		cerr << "Unknown snapshot format " << args["--format"].asString() << endl;
+		return 1;
+	}
+	SnapshotWriter writer(format, args["--png-compression"].asLong());
+	long burst = std::max(args["--burst"].asLong(), 1L), burstLeft = 0;
+	uint64_t sequence = 0, previousSequence = 0;
+
+	// views taken automatically, calibrated in the background
+	LiveCalibrator *live = NULL;
+	CornerTracker *tracker = NULL;
+	if(args["--live"].asBool()){
+		Size boardSize;
+		if(sscanf(args["--board"].asString().c_str(), "%dx%d", &boardSize.width, &boardSize.height) != 2
+				|| boardSize.width < 2 || boardSize.height < 2){
+			cerr << "Invalid board size " << args["--board"].asString() << endl;
+			return 1;
+		}
+		live = new LiveCalibrator(imageSize, boardSize, stof(args["--square"].asString()),
+				args["--live-output"].asString());
+		tracker = new CornerTracker(boardSize);
+	}
+
+	if(display){
+		namedWindow( "stream", WINDOW_NORMAL);
+		resizeWindow("stream", imageSize.width , imageSize.height);
+	}
 	int bmpCounter = 1;
+	long processed = 0;
+	int64 start = 0;
+	FrameContext context;
+	context.reserve(imageSize, CV_8UC3, s != NULL ? s->imageSize : Size());
+	const Mat &frame = context.frame;
+	Mat &frameRectified = context.rectified;
 	for (;;) {
-		Mat frame, frameUpscaled,frameRectified;
-		imageSource->next(frame);
+		previousSequence = sequence;
+		context.next(*asyncSource, sequence);
+		if(processed++ == 0)
+			start = getTickCount();
+		else if(processed > maxFrames && maxFrames > 0)
+			break;
+		if(!display){
+			if(s != NULL){
+				s->rectifyImage(frame, frameRectified); // resized to imageSize by the maps
+			}
+			allocations.frame();
+			continue;
+		}
+		if(burstLeft > 0){
+			// the rest of a burst, queued without display nor rectification to keep up with the camera
+			// the frames shown before the key press are not part of it
+			if(burstLeft < burst - 1 && sequence != previousSequence + 1)
+				cout << "burst: " << sequence - previousSequence - 1 << " frames missed" << endl;
+			writer.push(string("im") + std::to_string(bmpCounter++), frame);
+			if(--burstLeft == 0){
+				asyncSource->setMode(AsyncImageSource::LATEST);
+				cout << writer.pending() << " snapshots waiting" << endl;
+			}
+			allocations.frame();
+			continue;
+		}
+		Mat shown = frame;
+		if(live != NULL){
+			vector<Point2f> &corners = context.corners;
+			bool found = tracker->track(context.toGray(), corners);
+			if(found && live->offer(corners, tracker->motion()))
+				cout << "view " << live->views() << " accepted" << endl;
+			// drawn on a copy, the snapshots keep the frame as captured
+			if(frame.channels() == 3)
+				frame.copyTo(context.shown);
+			else
+				cvtColor(frame, context.shown, cv::COLOR_GRAY2RGB);
+			shown = context.shown;
+			drawChessboardCorners(shown, tracker->boardSize, corners, found);
+		}
 		if(s != NULL){
-			resize(frame, frameUpscaled, s->imageSize); //resize image
-			s->rectifyImage(frameUpscaled,frameRectified);
+			s->rectifyImage(frame, frameRectified); // resized to imageSize by the maps
 			imshow("stream", frameRectified);
 			if (waitKey(50) == 'a'){
-				cout << "miaou " << bmpCounter << endl;
-				Mat grayScaled,grayRectified;
-				cvtColor(frame, grayScaled, cv::COLOR_RGB2GRAY);
-				cvtColor(frameRectified, grayRectified, cv::COLOR_RGB2GRAY);
-				imwrite(string("im") + std::to_string(bmpCounter) + string(".bmp"), grayScaled);
-				imwrite(string("rec") + std::to_string(bmpCounter) + string(".bmp"), grayRectified);
+				cout << "miaou " << bmpCounter << ", " << writer.pending() << " snapshots waiting" << endl;
+				// converted to grey and written by the writer thread
+				writer.push(string("im") + std::to_string(bmpCounter), frame);
+				// a copy, the next frame is rectified into the same buffer
+				writer.push(string("rec") + std::to_string(bmpCounter), frameRectified.clone());
 //				rectangle(frame,Rect(0,0,imageSize.width,imageSize.height), Scalar(0,0,0,0),1,FILLED);
 //				imshow("stream", frameRectified);
 				bmpCounter++;
-				sleep(2);
+				burstLeft = burst - 1;
 			}
 		} else {
-			imshow("stream", frame);
+			imshow("stream", shown);
 			if (waitKey(50) == 'a'){
-				cout << "miaou " << bmpCounter << endl;
+				cout << "miaou " << bmpCounter << ", " << writer.pending() << " snapshots waiting" << endl;
 				putchar('\a');
-				Mat grayScaled;
-				cvtColor(frame, grayScaled, cv::COLOR_RGB2GRAY);
-				imwrite(string("im") + std::to_string(bmpCounter) + string(".bmp"), grayScaled);
+				writer.push(string("im") + std::to_string(bmpCounter), frame);
 				bmpCounter++;
 //				rectangle(frame,Rect(0,0,imageSize.width,imageSize.height), Scalar(0,0,0,0),1,FILLED);
 //				imshow("stream", frame);
-				sleep(2);
+				burstLeft = burst - 1;
 			}
 		}
+		if(burstLeft > 0)
+			asyncSource->setMode(AsyncImageSource::EVERY); // every frame of the burst from now on
+		allocations.frame();
 		if (waitKey(10) == 27)
 			break; // stop capturing by pressing ESC
 
 	}
+	// the first frame only starts the clock
+	double elapsed = (getTickCount() - start) / getTickFrequency();
+	if(processed > 1)
+		cout << processed - 1 << " frames processed in " << elapsed << " s, " << (processed - 1) / elapsed << " fps" << endl;
+	cout << asyncSource->captured() << " frames captured, " << asyncSource->dropped() << " dropped" << endl;
+	allocations.print(cout);
+	delete live; // waits for the calibration in progress
+	delete tracker;
+	context.frame.release(); // may reference a buffer of the source
+	delete imageSource;
 	return 0;
 }
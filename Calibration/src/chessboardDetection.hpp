@@ -0,0 +1,149 @@
+/*
+ * chessboardDetection.hpp
+ *
+ * Chessboard detection over an image list, pipelined and parallel.
+ */
+
+#ifndef SRC_CHESSBOARDDETECTION_HPP_
+#define SRC_CHESSBOARDDETECTION_HPP_
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <utility>
+
+#include "boundedQueue.hpp"
+
+using namespace cv;
+using namespace std;
+
+struct ChessboardDetection {
+	bool found;
+	vector<Point2f> corners;
+	Size imageSize; // empty if the image could not be read
+	Mat image;      // the decoded colour image, with keepImages only
+
+	ChessboardDetection() : found(false) {}
+};
+
+// Searches the board on the image reduced `levels` times by pyrDown, where
+// findChessboardCorners is much faster, and refines the upscaled corners with
+// cornerSubPix on the full resolution image. The refinement window grows with
+// the scale so that it covers the error of the upscaled estimate. Falls back
+// to the full resolution search when the reduced image gives no board.
+inline bool findChessboardCornersPyramid(const Mat &gray, Size boardSize, vector<Point2f> &corners,
+		int flags, int levels, Size subPixWindow = Size(11, 11),
+		TermCriteria subPixCriteria = TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 30, 0.1)) {
+	CV_Assert(gray.type() == CV_8UC1);
+	Mat reduced = gray;
+	int level = 0;
+	for (; level < levels && std::min(reduced.cols, reduced.rows) >= 256; level++)
+		pyrDown(reduced, reduced);
+
+	bool found = false;
+	if (level > 0 && findChessboardCorners(reduced, boardSize, corners, flags)) {
+		// pixel centers: x_full + 0.5 = (x_reduced + 0.5) * 2^level
+		float scale = (float) (1 << level);
+		for (size_t i = 0; i < corners.size(); i++)
+			corners[i] = (corners[i] + Point2f(0.5f, 0.5f)) * scale - Point2f(0.5f, 0.5f);
+		Size window(std::max(subPixWindow.width, 2 << level), std::max(subPixWindow.height, 2 << level));
+		cornerSubPix(gray, corners, window, Size(-1, -1), subPixCriteria);
+		found = true;
+	} else {
+		found = findChessboardCorners(gray, boardSize, corners, flags);
+		if (found)
+			cornerSubPix(gray, corners, subPixWindow, Size(-1, -1), subPixCriteria);
+	}
+	return found;
+}
+
+// Decoder threads read the images of the list into a bounded queue, a pool of
+// workers runs findChessboardCorners on them. Each result is stored at the
+// index of its image, so the output order does not depend on the scheduling.
+// The queue bounds the number of decoded full resolution frames in memory.
+class ChessboardDetector {
+public:
+	ChessboardDetector(Size boardSize,
+			int flags = CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE,
+			bool refine = false) :
+			boardSize(boardSize), flags(flags), refine(refine), pyramidLevels(0), flipVertical(false),
+			keepImages(false), subPixWindow(11, 11),
+			subPixCriteria(TermCriteria::EPS + TermCriteria::COUNT, 30, 0.1),
+			decoders(2), workers(std::max(getNumberOfCPUs(), 1)), queueDepth(0) {
+	}
+
+	void detect(const vector<string> &list, vector<ChessboardDetection> &results) const {
+		results.assign(list.size(), ChessboardDetection());
+
+		BoundedQueue<pair<int, Mat> > decoded(queueDepth > 0 ? queueDepth : 2 * workers);
+		std::atomic<int> next(0), decodersLeft(decoders);
+
+		vector<std::thread> threads;
+		for (int d = 0; d < decoders; d++) {
+			threads.push_back(std::thread([&] {
+				for (int i = next++; i < (int) list.size(); i = next++) {
+					Mat img = imread(list[i], keepImages ? IMREAD_COLOR : IMREAD_GRAYSCALE);
+					if (!decoded.push(make_pair(i, img)))
+						break;
+				}
+				if (--decodersLeft == 0)
+					decoded.close();
+			}));
+		}
+		for (int w = 0; w < workers; w++) {
+			threads.push_back(std::thread([&] {
+				pair<int, Mat> item;
+				Mat gray;
+				while (decoded.pop(item)) {
+					if (!keepImages || item.second.empty()) {
+						detectOne(item.second, results[item.first]);
+						continue;
+					}
+					// the caller gets the image as read, the detection works on a grey copy
+					results[item.first].image = item.second;
+					cvtColor(item.second, gray, COLOR_BGR2GRAY);
+					detectOne(gray, results[item.first]);
+				}
+			}));
+		}
+		for (size_t t = 0; t < threads.size(); t++)
+			threads[t].join();
+	}
+
+	// Detection on one grayscale image, as done by the workers
+	void detectOne(Mat &gray, ChessboardDetection &result) const {
+		if (gray.empty())
+			return;
+		if (flipVertical)
+			flip(gray, gray, 0);
+		result.imageSize = gray.size();
+		if (pyramidLevels > 0) {
+			result.found = findChessboardCornersPyramid(gray, boardSize, result.corners, flags,
+					pyramidLevels, subPixWindow, subPixCriteria);
+			return;
+		}
+		result.found = findChessboardCorners(gray, boardSize, result.corners, flags);
+		if (result.found && refine)
+			cornerSubPix(gray, result.corners, subPixWindow, Size(-1, -1), subPixCriteria);
+	}
+
+	Size boardSize;
+	int flags;                   // findChessboardCorners flags
+	bool refine;                 // refine the corners with cornerSubPix
+	int pyramidLevels;           // search on a reduced image, see findChessboardCornersPyramid (always refined)
+	bool flipVertical;           // flip the images around the horizontal axis before the detection
+	bool keepImages;             // decode in colour and return the images, not flipped, with the results
+	Size subPixWindow;
+	TermCriteria subPixCriteria;
+	int decoders;                // threads reading the images
+	int workers;                 // threads running the detection
+	int queueDepth;              // decoded images waiting for a worker, 0 for twice the workers
+};
+
+#endif /* SRC_CHESSBOARDDETECTION_HPP_ */
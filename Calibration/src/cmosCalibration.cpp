@@ -20,6 +20,8 @@
 #include <opencv2/videoio.hpp>
 #include <opencv2/highgui.hpp>
 
+#include "chessboardDetection.hpp"
+
 using namespace cv;
 using namespace std;
 
@@ -49,6 +51,8 @@ public:
                   << "Calibrate_AssumeZeroTangentialDistortion" << calibZeroTangentDist
                   << "Calibrate_FixPrincipalPointAtTheCenter" << calibFixPrincipalPoint
 
+                  << "Detect_PyramidLevels" << pyramidLevels
+
                   << "Write_DetectedFeaturePoints" << writePoints
                   << "Write_extrinsicParameters"   << writeExtrinsics
                   << "Write_outputFileName"  << outputFileName
@@ -83,6 +87,7 @@ public:
         node["Fix_K3"] >> fixK3;
         node["Fix_K4"] >> fixK4;
         node["Fix_K5"] >> fixK5;
+        node["Detect_PyramidLevels"] >> pyramidLevels;   // 0 when absent
 
         validate();
     }
@@ -104,6 +109,11 @@ public:
             cerr << "Invalid number of frames " << nrFrames << endl;
             goodInput = false;
         }
+        if (pyramidLevels < 0)
+        {
+            cerr << "Invalid number of pyramid levels " << pyramidLevels << endl;
+            goodInput = false;
+        }
 
         if (input.empty())      // Check for valid input
                 inputType = INVALID;
@@ -219,6 +229,7 @@ public:
     bool fixK3;                  // fix K3 distortion coefficient
     bool fixK4;                  // fix K4 distortion coefficient
     bool fixK5;                  // fix K5 distortion coefficient
+    int pyramidLevels;           // search the chessboard on the image reduced this many times, 0 for full resolution
 
     int cameraID;
     vector<string> imageList;
@@ -296,13 +307,40 @@ int main(int argc, char* argv[])
     const Scalar RED(0,0,255), GREEN(0,255,0);
     const char ESC_KEY = 27;
 
+    int chessBoardFlags = CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE;
+
+    if(!s.useFisheye) {
+        // fast check erroneously fails with high distortions like fisheye
+        chessBoardFlags |= CALIB_CB_FAST_CHECK;
+    }
+
+    // For an image list the chessboards of the first nrFrames images are detected up front, in
+    // parallel, and the loop below takes the decoded images from the results instead of reading
+    // them again; the images after them, if needed, are read and searched one at a time
+    vector<ChessboardDetection> detections;
+    if( s.inputType == Settings::IMAGE_LIST && s.calibrationPattern == Settings::CHESSBOARD )
+    {
+        ChessboardDetector detector(s.boardSize, chessBoardFlags, true);
+        detector.flipVertical = s.flipVertical;
+        detector.pyramidLevels = s.pyramidLevels;
+        detector.keepImages = true;
+        detector.detect(vector<string>(s.imageList.begin(), s.imageList.begin() + s.nrFrames), detections);
+    }
+
     //! [get_input]
     for(;;)
     {
         Mat view;
         bool blinkOutput = false;
 
-        view = s.nextImage();
+        if( s.atImageList < detections.size() )
+        {
+            // decoded by the detector
+            view = detections[s.atImageList].image;
+            detections[s.atImageList++].image.release();
+        }
+        else
+            view = s.nextImage();
 
         //-----  If no more image, or got enough, then stop calibration and show result -------------
         if( mode == CAPTURING && imagePoints.size() >= (size_t)s.nrFrames )
@@ -328,18 +366,29 @@ int main(int argc, char* argv[])
         vector<Point2f> pointBuf;
 
         bool found;
+        bool refined = false;
 
-        int chessBoardFlags = CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE;
-
-        if(!s.useFisheye) {
-            // fast check erroneously fails with high distortions like fisheye
-            chessBoardFlags |= CALIB_CB_FAST_CHECK;
-        }
-        cout << "analyse " << s.imageList[s.atImageList-1] << endl;
+        if( s.inputType == Settings::IMAGE_LIST )
+            cout << "analyse " << s.imageList[s.atImageList-1] << endl;
         switch( s.calibrationPattern ) // Find feature points on the input format
         {
         case Settings::CHESSBOARD:
-            found = findChessboardCorners( view, s.boardSize, pointBuf, chessBoardFlags);
+            if( !detections.empty() && s.atImageList <= detections.size() )
+            {
+                const ChessboardDetection& detection = detections[s.atImageList-1];
+                found = detection.found;
+                pointBuf = detection.corners;
+                refined = true;
+            }
+            else if( s.pyramidLevels > 0 )
+            {
+                Mat viewGray;
+                cvtColor(view, viewGray, COLOR_BGR2GRAY);
+                found = findChessboardCornersPyramid( viewGray, s.boardSize, pointBuf, chessBoardFlags, s.pyramidLevels);
+                refined = true;
+            }
+            else
+                found = findChessboardCorners( view, s.boardSize, pointBuf, chessBoardFlags);
             break;
         case Settings::CIRCLES_GRID:
             found = findCirclesGrid( view, s.boardSize, pointBuf );
@@ -356,7 +405,7 @@ int main(int argc, char* argv[])
         if ( found)                // If done with success,
         {
               // improve the found corners' coordinate accuracy for chessboard
-                if( s.calibrationPattern == Settings::CHESSBOARD)
+                if( s.calibrationPattern == Settings::CHESSBOARD && !refined)
                 {
                     Mat viewGray;
                     cvtColor(view, viewGray, COLOR_BGR2GRAY);
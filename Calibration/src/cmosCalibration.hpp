@@ -89,35 +89,45 @@ public:
     void validate(){
         goodInput = true;
 
-    	if (useFisheye) {
-    		Mat newCamMat;
+    	if (useFisheye)
     		fisheye::estimateNewCameraMatrixForUndistortRectify(cameraMatrix,
-    				distCoeffs, imageSize, Matx33d::eye(), newCamMat, 1);
-    		fisheye::initUndistortRectifyMap(cameraMatrix, distCoeffs,
-    				Matx33d::eye(), newCamMat, imageSize,
-    				CV_16SC2, map1, map2);
-    	} else {
-    		initUndistortRectifyMap(cameraMatrix, distCoeffs, Mat(),
-    				getOptimalNewCameraMatrix(cameraMatrix, distCoeffs,
-    						imageSize, 1, imageSize, 0), imageSize,
-    				CV_16SC2, map1, map2);
+    				distCoeffs, imageSize, Matx33d::eye(), newCameraMatrix, 1);
+    	else
+    		newCameraMatrix = getOptimalNewCameraMatrix(cameraMatrix, distCoeffs,
+    				imageSize, 1, imageSize, 0);
+    }
 
+    // Sensor points to the rectified image, without remapping the whole image
+    void rectifyPoints(const vector<Point2d> &src, vector<Point2d> &dst) const {
+    	if (src.empty()) {
+    		dst.clear();
+    		return;
     	}
+    	if (useFisheye)
+    		fisheye::undistortPoints(src, dst, cameraMatrix, distCoeffs, Matx33d::eye(), newCameraMatrix);
+    	else
+    		undistortPoints(src, dst, cameraMatrix, distCoeffs, noArray(), newCameraMatrix);
     }
 
-    void rectifyImage(Mat &src, Mat &dst){
-    	remap(src, dst, map1, map2, INTER_LINEAR);
+protected:
+    void initRectifyMapFloat(Mat &mapx, Mat &mapy){
+    	if (useFisheye)
+    		fisheye::initUndistortRectifyMap(cameraMatrix, distCoeffs,
+    				Matx33d::eye(), newCameraMatrix, imageSize,
+    				CV_32FC1, mapx, mapy);
+    	else
+    		initUndistortRectifyMap(cameraMatrix, distCoeffs, Mat(),
+    				newCameraMatrix, imageSize,
+    				CV_32FC1, mapx, mapy);
     }
 
-
 public:
     bool goodInput;
     int useFisheye;
     Mat cameraMatrix;
     Mat distCoeffs;
+    Mat newCameraMatrix; // of the rectified image
 
-	//Transformation setup
-	Mat view, rview, map1, map2;
 };
 //
 static inline void read(const FileNode& node, CmosParam& x, const CmosParam& default_value = CmosParam())
@@ -0,0 +1,128 @@
+/*
+ * cornerCache.hpp
+ *
+ * Cache of chessboard detections, keyed by the content of the images.
+ */
+
+#ifndef SRC_CORNERCACHE_HPP_
+#define SRC_CORNERCACHE_HPP_
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "chessboardDetection.hpp"
+
+using namespace cv;
+using namespace std;
+
+// The key of an image is the FNV-1a hash of its file, the board size and the
+// detection mode, so renamed files still hit and edited files miss. The cache
+// is a FileStorage file (compressed when its name ends with .gz) holding one
+// entry per key.
+class CornerCache {
+public:
+	// 64 bit FNV-1a of the file bytes, 0 if the file cannot be read
+	static uint64_t hashFile(const string &path) {
+		ifstream file(path.c_str(), ios::binary);
+		if (!file)
+			return 0;
+		uint64_t hash = 14695981039346656037ULL;
+		vector<char> buffer(1 << 16);
+		while (file) {
+			file.read(&buffer[0], buffer.size());
+			streamsize n = file.gcount();
+			for (streamsize i = 0; i < n; i++) {
+				hash ^= (unsigned char) buffer[i];
+				hash *= 1099511628211ULL;
+			}
+		}
+		return hash;
+	}
+
+	// Hashes of all the files of the list, in parallel
+	static void hashFiles(const vector<string> &list, vector<uint64_t> &hashes) {
+		hashes.assign(list.size(), 0);
+		parallel_for_(Range(0, (int) list.size()), HashBody(list, hashes));
+	}
+
+	static string key(uint64_t hash, Size boardSize, const string &mode) {
+		return format("%016llx_%dx%d_%s", (unsigned long long) hash, boardSize.width,
+				boardSize.height, mode.c_str());
+	}
+
+	bool load(const string &filename) {
+		entries.clear();
+		FileStorage fs(filename, FileStorage::READ);
+		if (!fs.isOpened())
+			return false;
+		FileNode n = fs["detections"];
+		for (FileNodeIterator it = n.begin(); it != n.end(); ++it) {
+			string k;
+			int found;
+			ChessboardDetection d;
+			Mat corners;
+			(*it)["key"] >> k;
+			(*it)["found"] >> found;
+			(*it)["image_size"] >> d.imageSize;
+			(*it)["corners"] >> corners;
+			d.found = found != 0;
+			if (!corners.empty())
+				corners.reshape(2, (int) corners.total() * corners.channels() / 2).copyTo(d.corners);
+			entries[k] = d;
+		}
+		return true;
+	}
+
+	bool save(const string &filename) const {
+		FileStorage fs(filename, FileStorage::WRITE);
+		if (!fs.isOpened())
+			return false;
+		fs << "detections" << "[";
+		for (map<string, ChessboardDetection>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+			fs << "{" << "key" << it->first << "found" << (int) it->second.found
+					<< "image_size" << it->second.imageSize;
+			if (!it->second.corners.empty())
+				fs << "corners" << Mat(it->second.corners);
+			fs << "}";
+		}
+		fs << "]";
+		return true;
+	}
+
+	bool lookup(const string &k, ChessboardDetection &d) const {
+		map<string, ChessboardDetection>::const_iterator it = entries.find(k);
+		if (it == entries.end())
+			return false;
+		d = it->second;
+		return true;
+	}
+
+	void store(const string &k, const ChessboardDetection &d) {
+		entries[k] = d;
+	}
+
+private:
+	class HashBody: public ParallelLoopBody {
+	public:
+		HashBody(const vector<string> &list, vector<uint64_t> &hashes) : list(list), hashes(hashes) {
+		}
+
+		void operator()(const Range &range) const {
+			for (int i = range.start; i < range.end; i++)
+				hashes[i] = hashFile(list[i]);
+		}
+
+	private:
+		const vector<string> &list;
+		vector<uint64_t> &hashes;
+	};
+
+	map<string, ChessboardDetection> entries;
+};
+
+#endif /* SRC_CORNERCACHE_HPP_ */
@@ -0,0 +1,194 @@
+/*
+ * equirectConverter.cpp
+ *
+ * Converts a set of omnidirectional images into equirectangular images with
+ * the model of a calibration file written by omniCalibration.
+ */
+
+#include "omnidir.cpp"
+#include "tiledRemap.hpp"
+#include "boundedQueue.hpp"
+#include "opencv2/ccalib/omnidir.hpp"
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include <vector>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+using namespace cv;
+using namespace std;
+using namespace std::chrono;
+
+static void help() {
+	printf(
+			"\n Converts omnidirectional images into equirectangular images.\n"
+					"Usage: equirectConverter\n"
+					"    [-mirror <x> <y> <r>] # mirror circle on the sensor image, pixels outside are left black\n"
+					"    [-size <width>] # width and height of the equirectangular images (input width by default)\n"
+					"    [-ext <extension>] # format of the output images, e.g. png (input extension by default)\n"
+					"    [-j <threads>] # threads decoding and encoding each (number of CPUs by default)\n"
+					"    [-q <depth>] # images waiting between two stages (8 by default)\n"
+					"    calibration # out_camera_omni.xml written by omniCalibration\n"
+					"    input # directory or pattern of the input images, e.g. img/trajectoryA/*.bmp\n"
+					"    output # existing directory of the equirectangular images\n");
+}
+
+struct Frame {
+	int index;
+	Mat image;
+};
+
+int main(int argc, char** argv) {
+	const double pi = 3.141592653589793;
+	Vec3f mirror;
+	int width = 0;
+	string extension;
+	int threads = std::max(getNumberOfCPUs(), 1);
+	int queueDepth = 8;
+	vector<const char*> positional;
+
+	for (int i = 1; i < argc; i++) {
+		const char* s = argv[i];
+		if (strcmp(s, "-mirror") == 0) {
+			if (i + 3 >= argc || sscanf(argv[++i], "%f", &mirror[0]) != 1
+					|| sscanf(argv[++i], "%f", &mirror[1]) != 1
+					|| sscanf(argv[++i], "%f", &mirror[2]) != 1 || mirror[2] <= 0)
+				return fprintf(stderr, "Invalid mirror circle\n"), -1;
+		} else if (strcmp(s, "-size") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &width) != 1 || width <= 0)
+				return fprintf(stderr, "Invalid size\n"), -1;
+		} else if (strcmp(s, "-ext") == 0) {
+			if (i + 1 >= argc)
+				return fprintf(stderr, "Missing extension\n"), -1;
+			extension = argv[++i];
+			if (!extension.empty() && extension[0] == '.')
+				extension = extension.substr(1);
+		} else if (strcmp(s, "-j") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &threads) != 1 || threads <= 0)
+				return fprintf(stderr, "Invalid number of threads\n"), -1;
+		} else if (strcmp(s, "-q") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &queueDepth) != 1 || queueDepth <= 0)
+				return fprintf(stderr, "Invalid queue depth\n"), -1;
+		} else if (s[0] != '-') {
+			positional.push_back(s);
+		} else {
+			return fprintf(stderr, "Unknown option %s\n", s), -1;
+		}
+	}
+	if (positional.size() != 3) {
+		help();
+		return 1;
+	}
+	string calibrationFilename = positional[0], input = positional[1], outputDir = positional[2];
+
+	// camera model
+	Mat K, D;
+	double xi = 0;
+	Size imageSize;
+	FileStorage fs(calibrationFilename, FileStorage::READ);
+	if (!fs.isOpened())
+		return fprintf(stderr, "Failed to open %s\n", calibrationFilename.c_str()), -1;
+	fs["camera_matrix"] >> K;
+	fs["distortion_coefficients"] >> D;
+	fs["xi"] >> xi;
+	fs["imageSize"] >> imageSize;
+	fs.release();
+	if (K.empty() || D.empty() || imageSize.area() == 0)
+		return fprintf(stderr, "Invalid calibration file %s\n", calibrationFilename.c_str()), -1;
+
+	vector<String> files;
+	glob(input, files, false);
+	if (files.empty())
+		return fprintf(stderr, "No input image in %s\n", input.c_str()), -1;
+
+	// one map set for all the images, same projection as omniCalibration
+	if (width == 0)
+		width = imageSize.width;
+	Size equirectSize(width, width);
+	Matx33f Knew(width / pi, 0, width / 2, 0, width / pi, 0, 0, 0, 1);
+	Mat R = Mat::eye(3, 3, CV_64F);
+	Mat map1, map2;
+	omnidir::initUndistortRectifyMap(K, D, xi, R, Knew, equirectSize, CV_16SC2, map1, map2,
+			omnidir::RECTIFY_LONGLATI);
+	TiledRemap tiledRemap(map1, map2, imageSize, INTER_CUBIC, BORDER_CONSTANT, mirror);
+
+	// decode -> remap -> encode, each stage connected by a bounded queue so that
+	// the memory stays bounded and the slowest stage sets the pace
+	BoundedQueue<Frame> decoded(queueDepth), remapped(queueDepth);
+	std::atomic<int> next(0), decodersLeft(threads), written(0), failed(0);
+	int n = (int) files.size();
+	high_resolution_clock::time_point start = high_resolution_clock::now();
+
+	vector<std::thread> decoders, encoders;
+	for (int t = 0; t < threads; t++) {
+		decoders.push_back(std::thread([&] {
+			for (int i = next++; i < n; i = next++) {
+				Frame frame;
+				frame.index = i;
+				frame.image = imread(files[i], IMREAD_COLOR);
+				if (frame.image.size() != imageSize) {
+					cerr << "Skipping " << files[i] << ": not a " << imageSize << " image" << endl;
+					failed++;
+					continue;
+				}
+				decoded.push(frame);
+			}
+			if (--decodersLeft == 0)
+				decoded.close();
+		}));
+	}
+
+	std::thread remapper([&] {
+		Frame frame;
+		while (decoded.pop(frame)) {
+			Frame out;
+			out.index = frame.index;
+			tiledRemap.remap(frame.image, out.image); // parallel over the tiles
+			remapped.push(out);
+		}
+		remapped.close();
+	});
+
+	for (int t = 0; t < threads; t++) {
+		encoders.push_back(std::thread([&] {
+			Frame frame;
+			while (remapped.pop(frame)) {
+				string name = files[frame.index];
+				size_t slash = name.find_last_of("/\\");
+				if (slash != string::npos)
+					name = name.substr(slash + 1);
+				if (!extension.empty())
+					name = name.substr(0, name.find_last_of('.')) + "." + extension;
+				if (!imwrite(outputDir + "/" + name, frame.image)) {
+					cerr << "Failed to write " << outputDir + "/" + name << endl;
+					failed++;
+					continue;
+				}
+				int done = ++written;
+				if (done % 50 == 0) {
+					double elapsed = duration_cast<milliseconds>(high_resolution_clock::now() - start).count() / 1000.0;
+					cout << done << "/" << n << " images, " << done / elapsed << " fps" << endl << flush;
+				}
+			}
+		}));
+	}
+
+	for (size_t t = 0; t < decoders.size(); t++)
+		decoders[t].join();
+	remapper.join();
+	for (size_t t = 0; t < encoders.size(); t++)
+		encoders[t].join();
+
+	double elapsed = duration_cast<milliseconds>(high_resolution_clock::now() - start).count() / 1000.0;
+	int nWritten = written.load(), nFailed = failed.load();
+	cout << nWritten << " images converted in " << elapsed << " s, "
+			<< (elapsed > 0 ? nWritten / elapsed : 0) << " fps";
+	if (nFailed > 0)
+		cout << ", " << nFailed << " failed";
+	cout << endl;
+	return nFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * frameContext.hpp
+ *
+ * Buffers of a capture loop kept from one frame to the next, and a count of
+ * the Mat allocations to check that the loop no longer allocates once it runs.
+ */
+
+#ifndef SRC_FRAMECONTEXT_HPP_
+#define SRC_FRAMECONTEXT_HPP_
+
+#include <opencv2/core.hpp>
+#include <vector>
+#include <atomic>
+#include <iostream>
+#include <stdint.h>
+
+#include "imageSource.hpp"
+
+using namespace cv;
+using namespace std;
+
+// Default allocator of the Mat buffers that counts them, the buffers
+// themselves come from the standard allocator which also frees them. Only the
+// Mat buffers are counted, not the std::vector ones.
+class AllocationCounter: public MatAllocator {
+public:
+	// The counter of the process, the default allocator from the first call on
+	static AllocationCounter &install() {
+		static AllocationCounter *counter = new AllocationCounter(); // never destroyed, Mats may outlive main
+		Mat::setDefaultAllocator(counter);
+		return *counter;
+	}
+
+	UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags,
+			UMatUsageFlags usageFlags) const {
+		UMatData* u = base->allocate(dims, sizes, type, data, step, flags, usageFlags);
+		if (u != 0 && data == 0) {
+			count++;
+			bytes += u->size;
+		}
+		return u;
+	}
+
+	bool allocate(UMatData* u, int accessFlags, UMatUsageFlags usageFlags) const {
+		return base->allocate(u, accessFlags, usageFlags);
+	}
+
+	void deallocate(UMatData* u) const {
+		base->deallocate(u);
+	}
+
+	uint64_t allocations() const {
+		return count;
+	}
+
+	uint64_t allocatedBytes() const {
+		return bytes;
+	}
+
+private:
+	AllocationCounter() : base(Mat::getStdAllocator()), count(0), bytes(0) {
+	}
+
+	MatAllocator *base;
+	mutable std::atomic<uint64_t> count, bytes;
+};
+
+// Mat allocations per frame once the first frames, which size the buffers, are
+// past; 0 in the steady state of a loop that reuses its buffers.
+class AllocationReport {
+public:
+	AllocationReport(long warmup = 10) :
+			counter(AllocationCounter::install()), warmup(warmup), frames(0), startCount(0), startBytes(0) {
+	}
+
+	// At the end of each frame
+	void frame() {
+		if (++frames == warmup) {
+			startCount = counter.allocations();
+			startBytes = counter.allocatedBytes();
+		}
+	}
+
+	void print(ostream &out) const {
+		if (frames <= warmup) {
+			out << "allocations: fewer than " << warmup << " frames" << endl;
+			return;
+		}
+		long n = frames - warmup;
+		uint64_t count = counter.allocations() - startCount, bytes = counter.allocatedBytes() - startBytes;
+		out << "allocations: " << count << " Mat buffers, " << bytes / 1024 << " KiB in the last " << n
+				<< " frames, " << (double) count / n << " per frame" << endl;
+	}
+
+private:
+	AllocationCounter &counter;
+	long warmup, frames;
+	uint64_t startCount, startBytes;
+};
+
+// Everything computed from a frame, owned by the loop of one stream. The Mats
+// are created with the size and type of the first frame, and the OpenCV
+// functions writing into them reuse their memory as long as these don't
+// change; the vectors keep their capacity when cleared.
+struct FrameContext {
+	// Buffers for frames of frameSize and type, rectified to rectifiedSize if not empty
+	void reserve(Size frameSize, int type, Size rectifiedSize = Size()) {
+		gray.create(frameSize, CV_8UC1);
+		shown.create(frameSize, CV_8UC3);
+		if (rectifiedSize.area() > 0)
+			rectified.create(rectifiedSize, type);
+	}
+
+	// The previous frame is released first: AsyncImageSource refills a slot in
+	// place only when nothing else references it. Release frame as well before
+	// the source is destroyed.
+	void next(ImageSource &source) {
+		frame.release();
+		source.next(frame);
+	}
+
+	void next(AsyncImageSource &source, uint64_t &sequence) {
+		frame.release();
+		source.next(frame, sequence);
+	}
+
+	// frame as grey, without copy when it already is
+	const Mat &toGray() {
+		if (frame.channels() == 1)
+			return frame;
+		cvtColor(frame, gray, COLOR_RGB2GRAY);
+		return gray;
+	}
+
+	Mat frame;     // as delivered by the source
+	Mat gray;
+	Mat rectified;
+	Mat shown;     // frame with overlays, for the display
+	Mat small;     // reduced frame, for the display
+
+	vector<Point2f> corners;
+	vector<Point2d> edges, scaled, points;
+	vector<Point2i> pointPositions;
+	vector<bool> found;
+};
+
+#endif /* SRC_FRAMECONTEXT_HPP_ */
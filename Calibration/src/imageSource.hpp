@@ -9,6 +9,22 @@
 #define SRC_IMAGESOURCE_HPP_
 
 #include "opencv2/opencv.hpp"
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
+#include <cmath>
+#include <cctype>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 using namespace cv;
 using namespace std;
 
@@ -38,32 +54,533 @@ public:
 };
 
 #include "v4ldevice.h"
+
+// Gives a dequeued V4L2 buffer back to its device when the last Mat
+// referencing it is released. The Mats are built by wrap(), never allocated.
+class V4lBufferAllocator: public MatAllocator {
+public:
+	V4lBufferAllocator(V4l2Device &device) : device(&device) {
+	}
+
+	Mat wrap(unsigned char* data, unsigned int index) const {
+		Mat m(device->height(), device->width(), CV_8UC1, data, device->stride());
+		UMatData* u = new UMatData(this);
+		u->data = u->origdata = data;
+		u->size = (size_t) device->stride() * device->height();
+		u->userdata = (void*) (size_t) index;
+		u->refcount = 1;
+		m.u = u;
+		m.allocator = this;
+		return m;
+	}
+
+	UMatData* allocate(int, const int*, int, void*, size_t*, int, UMatUsageFlags) const {
+		CV_Error(Error::StsNotImplemented, "V4L2 buffers are not allocated by OpenCV");
+		return 0;
+	}
+
+	bool allocate(UMatData*, int, UMatUsageFlags) const {
+		return false;
+	}
+
+	void unmap(UMatData* u) const {
+		if (u->urefcount == 0 && u->refcount == 0)
+			deallocate(u);
+	}
+
+	void deallocate(UMatData* u) const {
+		if (!u)
+			return;
+		// the last Mat may be released on any thread, the capture one may be dequeuing
+		string error;
+		if (!device->queue((unsigned int) (size_t) u->userdata, &error))
+			fprintf(stderr, "%s\n", error.c_str());
+		delete u;
+	}
+
+private:
+	V4l2Device* device;
+};
+
+// grab() returns the grey frame in place in the mmap buffer, without copy; the
+// buffer goes back to the driver when the last Mat referencing it is released,
+// so a frame can be kept while the next ones are captured. The driver has 4
+// buffers, holding them all stalls the capture, and the frames must be released
+// before the source is destroyed. next() converts the frame to RGB for the
+// callers expecting colour, unless color is false.
 class V4lImageSource: public ImageSource {
 public:
-	V4lImageSource(int cameraId, CvSize ImageSize) {
-		pOpenCVImage = cvCreateImage(ImageSize, IPL_DEPTH_8U, 1); // Grayscale
-		pColorCVImage = cvCreateImage(ImageSize , IPL_DEPTH_8U, 3 ); // Color image
-		open_device((char*)((string("/dev/video") + to_string(cameraId)).c_str()));
-		init_device(ImageSize.width, ImageSize.height);
-		start_capturing();
+	V4lImageSource(int cameraId, CvSize ImageSize, bool color = true) : color(color), allocator(device) {
+		if (!device.open((string("/dev/video") + to_string(cameraId)).c_str())
+				|| !device.init(ImageSize.width, ImageSize.height) || !device.start())
+			CV_Error(Error::StsError, device.error());
+	}
+
+	Mat grab() {
+		unsigned int index;
+		unsigned char* data = device.dequeue(&index);
+		if (data == NULL)
+			CV_Error(Error::StsError, device.error());
+		return allocator.wrap(data, index);
 	}
 
 	virtual void next(Mat &image) {
-		ImageBuffer = snapFrame();
+		Mat frame = grab();
+		if (color)
+			cvtColor(frame, image, COLOR_GRAY2RGB);
+		else
+			image = frame;
+	}
+
+	bool color;
+	V4l2Device device;
+
+private:
+	V4lBufferAllocator allocator;
+};
+
+// Holds next() back until the time of each frame, measured from the first
+// frame; no wait for a time <= 0.
+class FramePacer {
+public:
+	FramePacer() : started(false) {
+	}
 
-		if (ImageBuffer != NULL) {
-			memcpy(pOpenCVImage->imageData, ImageBuffer,
-					pOpenCVImage->imageSize);
-			cvCvtColor(pOpenCVImage, pColorCVImage, CV_GRAY2RGB); // Create a color image from the raw data
-			image = cv::cvarrToMat(pColorCVImage);
+	void restart() {
+		started = false;
+	}
+
+	void wait(double seconds) {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (!started) {
+			start = now;
+			started = true;
+		}
+		if (seconds > 0)
+			std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t) (seconds * 1e6)));
+	}
+
+private:
+	bool started;
+	std::chrono::steady_clock::time_point start;
+};
+
+// Replays a sequence of recorded frames, e.g. img/trajectoryA/*.raw, in
+// natural order of the file names. The files are mapped in memory rather than
+// read: a .raw frame is the square BayerRG8 sensor image written by
+// Grab_UsingActionCommand, demosaiced to RGB straight from the mapping as
+// raw2bmp does; any other file is decoded by imdecode. fps > 0 replays at that
+// rate, fps = 0 as fast as possible, fps < 0 at the recorded rate given by the
+// "Capture Time" of the .txt sidecars, whose second resolution is spread evenly
+// over the frames of the same second.
+class ReplayImageSource: public ImageSource {
+public:
+	ReplayImageSource(const string &pattern, double fps = 0, bool loop = true) : loop(loop), current(0) {
+		vector<String> found;
+		glob(pattern, found, false);
+		if (found.empty())
+			CV_Error(Error::StsError, "No frame in " + pattern);
+		files.assign(found.begin(), found.end());
+		std::sort(files.begin(), files.end(), naturalLess);
+		for (size_t i = 0; i < files.size(); i++)
+			mapFile(files[i]);
+		times.assign(files.size(), 0);
+		if (fps > 0) {
+			for (size_t i = 0; i < files.size(); i++)
+				times[i] = i / fps;
+		} else if (fps < 0) {
+			recordedTimes();
+		}
+	}
+
+	virtual ~ReplayImageSource() {
+		for (size_t i = 0; i < mappings.size(); i++)
+			munmap(mappings[i].first, mappings[i].second);
+	}
+
+	virtual void next(Mat &image) {
+		if (current == files.size()) {
+			if (!loop)
+				CV_Error(Error::StsError, "End of the replayed sequence");
+			current = 0;
+			pacer.restart();
+		}
+		pacer.wait(times[current]);
+		const pair<void*, size_t> &m = mappings[current];
+		if (isRaw(files[current])) {
+			int side = (int) std::sqrt((double) m.second);
+			if ((size_t) side * side != m.second)
+				CV_Error(Error::StsError, files[current] + " is not a square raw frame");
+			cvtColor(Mat(side, side, CV_8UC1, m.first), image, COLOR_BayerRG2RGB);
 		} else {
-			printf("No image buffer retrieved.\n");
-			throw;
+			image = imdecode(Mat(1, (int) m.second, CV_8UC1, m.first), IMREAD_COLOR);
+			if (image.empty())
+				CV_Error(Error::StsError, "Failed to decode " + files[current]);
+		}
+		current++;
+	}
+
+	size_t size() const {
+		return files.size();
+	}
+
+private:
+	static bool isRaw(const string &file) {
+		return file.size() > 4 && file.compare(file.size() - 4, 4, ".raw") == 0;
+	}
+
+	// img_0_9.raw before img_0_10.raw
+	static bool naturalLess(const string &a, const string &b) {
+		size_t i = 0, j = 0;
+		while (i < a.size() && j < b.size()) {
+			if (isdigit((unsigned char) a[i]) && isdigit((unsigned char) b[j])) {
+				size_t ei = i, ej = j;
+				while (ei < a.size() && isdigit((unsigned char) a[ei]))
+					ei++;
+				while (ej < b.size() && isdigit((unsigned char) b[ej]))
+					ej++;
+				string na = a.substr(i, ei - i), nb = b.substr(j, ej - j);
+				na.erase(0, std::min(na.find_first_not_of('0'), na.size()));
+				nb.erase(0, std::min(nb.find_first_not_of('0'), nb.size()));
+				if (na.size() != nb.size())
+					return na.size() < nb.size();
+				if (na != nb)
+					return na < nb;
+				i = ei;
+				j = ej;
+			} else {
+				if (a[i] != b[j])
+					return a[i] < b[j];
+				i++;
+				j++;
+			}
+		}
+		return a.size() - i < b.size() - j;
+	}
+
+	void mapFile(const string &file) {
+		int fd = ::open(file.c_str(), O_RDONLY);
+		struct stat st;
+		if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+			if (fd != -1)
+				::close(fd);
+			CV_Error(Error::StsError, "Cannot read " + file);
+		}
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			CV_Error(Error::StsError, "Cannot map " + file);
+		mappings.push_back(make_pair(data, (size_t) st.st_size));
+	}
+
+	void recordedTimes() {
+		vector<double> seconds(files.size());
+		for (size_t i = 0; i < files.size(); i++) {
+			string sidecar = files[i].substr(0, files[i].find_last_of('.')) + ".txt", line;
+			ifstream in(sidecar.c_str());
+			struct tm t = tm();
+			bool found = false;
+			while (!found && getline(in, line))
+				found = line.compare(0, 14, "Capture Time: ") == 0
+						&& strptime(line.c_str() + 14, "%a %b %d %H:%M:%S %Y", &t) != NULL;
+			if (!found)
+				CV_Error(Error::StsError, "No capture time in " + sidecar);
+			t.tm_isdst = -1;
+			seconds[i] = (double) mktime(&t);
+		}
+		for (size_t a = 0; a < files.size();) {
+			size_t b = a;
+			while (b < files.size() && seconds[b] == seconds[a])
+				b++;
+			double span = b < files.size() ? std::max(seconds[b] - seconds[a], 0.) : 1;
+			for (size_t k = a; k < b; k++)
+				times[k] = seconds[a] - seconds[0] + span * (k - a) / (b - a);
+			a = b;
 		}
 	}
-	IplImage* pOpenCVImage;
-	IplImage* pColorCVImage;
-	unsigned char* ImageBuffer = NULL;
+
+	vector<string> files;
+	vector<pair<void*, size_t> > mappings;
+	vector<double> times; // seconds from the first frame
+	bool loop;
+	size_t current;
+	FramePacer pacer;
+};
+
+// Renders frames of known content, to run the capture and rectification paths
+// without a camera. CHESSBOARD is a board of boardSize inner corners seen by a
+// Mei camera of intrinsics K and xi without distortion, from a pose slowly
+// turning with the frame index; MIRROR is the bright disc of a mirror of centre
+// and radius `mirror` on a dark sensor. The frames are RGB, grey in colour.
+class SyntheticImageSource: public ImageSource {
+public:
+	enum Pattern {
+		CHESSBOARD, MIRROR
+	};
+
+	SyntheticImageSource(Size imageSize, Pattern pattern = CHESSBOARD, double fps = 0) :
+			imageSize(imageSize), pattern(pattern), boardSize(9, 6), squareSize(17.5), xi(1), frameIndex(0),
+			fps(fps) {
+		double f = imageSize.width / 4.;
+		K = Matx33d(f, 0, imageSize.width / 2., 0, f, imageSize.height / 2., 0, 0, 1);
+		mirror = Vec3f(imageSize.width / 2.f, imageSize.height / 2.f, std::min(imageSize.width, imageSize.height) * 0.45f);
+	}
+
+	virtual void next(Mat &image) {
+		pacer.wait(fps > 0 ? frameIndex / fps : 0);
+		image.create(imageSize, CV_8UC3);
+		if (pattern == MIRROR) {
+			image.setTo(Scalar::all(20));
+			circle(image, Point2f(mirror[0], mirror[1]), cvRound(mirror[2]), Scalar::all(200), FILLED, LINE_AA);
+		} else {
+			if (bearings.empty())
+				lift();
+			Vec3d om, T;
+			pose(frameIndex, om, T);
+			parallel_for_(Range(0, imageSize.height), RenderBody(*this, om, T, image));
+		}
+		frameIndex++;
+	}
+
+	// Board to camera pose of a frame, the board about 400 units away
+	void pose(uint64_t frame, Vec3d &om, Vec3d &T) const {
+		double a = frame * 0.02;
+		Vec3d centre(-squareSize * (boardSize.width - 1) / 2, -squareSize * (boardSize.height - 1) / 2, 0);
+		om = Vec3d(0.3 * std::sin(a), 0.3 * std::cos(0.7 * a), 0.2 * a);
+		Matx33d R;
+		Rodrigues(om, R);
+		T = Vec3d(150 * std::sin(0.5 * a), 100 * std::cos(0.3 * a), 400) + R * centre;
+	}
+
+	Size imageSize;
+	Pattern pattern;
+	Size boardSize;    // inner corners
+	double squareSize;
+	Matx33d K;
+	double xi;
+	Vec3f mirror;      // centre and radius in pixels
+	uint64_t frameIndex;
+
+private:
+	// Unit bearing of every pixel, the closed form inverse of the model without distortion
+	void lift() {
+		bearings.create(imageSize, CV_32FC3);
+		for (int v = 0; v < imageSize.height; v++) {
+			for (int u = 0; u < imageSize.width; u++) {
+				double y = (v - K(1, 2)) / K(1, 1), x = (u - K(0, 2) - K(0, 1) * y) / K(0, 0), r2 = x * x + y * y;
+				double s = (xi + std::sqrt(std::max(1 + (1 - xi * xi) * r2, 0.))) / (r2 + 1);
+				bearings.at<Vec3f>(v, u) = Vec3f((float) (s * x), (float) (s * y), (float) (s - xi));
+			}
+		}
+	}
+
+	// Intersects the ray of each pixel of a band of rows with the board plane
+	class RenderBody: public ParallelLoopBody {
+	public:
+		RenderBody(const SyntheticImageSource &source, const Vec3d &om, const Vec3d &T, Mat &image) :
+				source(source), image(image) {
+			Rodrigues(om, Rt);
+			Rt = Rt.t();
+			origin = -(Rt * T); // camera centre in the board frame
+		}
+
+		void operator()(const Range &range) const {
+			const double sq = source.squareSize;
+			const double w = sq * source.boardSize.width, h = sq * source.boardSize.height;
+			for (int v = range.start; v < range.end; v++) {
+				const Vec3f *b = source.bearings.ptr<Vec3f>(v);
+				Vec3b *out = image.ptr<Vec3b>(v);
+				for (int u = 0; u < source.imageSize.width; u++) {
+					Vec3d d = Rt * Vec3d(b[u][0], b[u][1], b[u][2]);
+					uchar value = 60; // background
+					double t = d[2] != 0 ? -origin[2] / d[2] : -1;
+					if (t > 0) {
+						double x = origin[0] + t * d[0], y = origin[1] + t * d[1];
+						// one white square of border around the squares
+						if (x >= -2 * sq && x < w + sq && y >= -2 * sq && y < h + sq) {
+							value = 230;
+							if (x >= -sq && x < w && y >= -sq && y < h)
+								value = ((int) std::floor(x / sq) + (int) std::floor(y / sq)) & 1 ? 230 : 25;
+						}
+					}
+					out[u] = Vec3b(value, value, value);
+				}
+			}
+		}
+
+	private:
+		const SyntheticImageSource &source;
+		Matx33d Rt;
+		Vec3d origin;
+		Mat &image;
+	};
+
+	Mat bearings;
+	double fps;
+	FramePacer pacer;
+};
+
+// Runs the acquisition of another source on its own thread into a fixed pool of
+// slots, so that the time spent on a frame by the caller no longer slows the
+// capture down. In LATEST mode next() returns the newest frame and the older
+// ones not read yet are dropped; in EVERY mode it returns the frames in capture
+// order and a frame is dropped only when all the slots hold unread frames.
+// Frames are numbered from 1 in capture order, a gap seen by the caller is a
+// drop. The returned Mat shares the memory of its slot; the slot is refilled in
+// place only once the caller has released it, otherwise it gets a new buffer.
+// A zero-copy V4lImageSource pins a driver buffer per slot, so keep the slots
+// below its buffer count or let it convert to colour. The frames returned by
+// next() must be released before the AsyncImageSource is destroyed, as they may
+// reference buffers of the source.
+class AsyncImageSource: public ImageSource {
+public:
+	enum Mode {
+		LATEST, EVERY
+	};
+
+	// Takes the ownership of source
+	AsyncImageSource(ImageSource *source, Mode mode = LATEST, int slotCount = 4) :
+			source(source), mode(mode), slots(std::max(slotCount, 2)), nextSequence(1), capturedFrames(0),
+			droppedFrames(0), running(true) {
+		worker = std::thread(&AsyncImageSource::capture, this);
+	}
+
+	// Waits for the frame being captured
+	virtual ~AsyncImageSource() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		worker.join();
+		// the slot images may reference buffers of the source, released while it still exists
+		slots.clear();
+		delete source;
+	}
+
+	virtual void next(Mat &image) {
+		uint64_t sequence;
+		next(image, sequence);
+	}
+
+	// Waits for a frame not returned yet, throws the error of the source once
+	// the frames captured before it are consumed
+	void next(Mat &image, uint64_t &sequence) {
+		std::unique_lock<std::mutex> lock(mutex);
+		ready.wait(lock, [this] { return !failure.empty() || firstReady(true) >= 0; });
+		int i = firstReady(mode == EVERY);
+		if (i < 0)
+			CV_Error(Error::StsError, failure);
+		if (mode == LATEST) {
+			for (size_t k = 0; k < slots.size(); k++) {
+				if (slots[k].state == Slot::READY && (int) k != i) {
+					slots[k].state = Slot::FREE;
+					droppedFrames++;
+				}
+			}
+		}
+		image = slots[i].image;
+		sequence = slots[i].sequence;
+		slots[i].state = Slot::FREE;
+	}
+
+	// e.g. EVERY for the duration of a burst of snapshots
+	void setMode(Mode mode) {
+		std::lock_guard<std::mutex> lock(mutex);
+		this->mode = mode;
+	}
+
+	// Frames delivered by the source
+	uint64_t captured() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return capturedFrames;
+	}
+
+	// Frames overwritten or discarded before being returned by next()
+	uint64_t dropped() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return droppedFrames;
+	}
+
+private:
+	struct Slot {
+		enum State {
+			FREE, FILLING, READY
+		};
+		Slot() : sequence(0), state(FREE) {
+		}
+		Mat image;
+		uint64_t sequence;
+		State state;
+	};
+
+	// Ready slot of the lowest (oldest) or highest sequence, -1 if none
+	int firstReady(bool oldest) const {
+		int best = -1;
+		for (size_t k = 0; k < slots.size(); k++) {
+			if (slots[k].state != Slot::READY)
+				continue;
+			if (best < 0 || (oldest ? slots[k].sequence < slots[best].sequence : slots[k].sequence > slots[best].sequence))
+				best = (int) k;
+		}
+		return best;
+	}
+
+	void capture() {
+		Mat overflow; // frame captured while every slot is full in EVERY mode, then discarded
+		for (;;) {
+			int i = -1;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!running)
+					return;
+				for (size_t k = 0; k < slots.size() && i < 0; k++)
+					if (slots[k].state == Slot::FREE)
+						i = (int) k;
+				if (i < 0 && mode == LATEST) {
+					i = firstReady(true);
+					droppedFrames++;
+				}
+				if (i >= 0) {
+					slots[i].state = Slot::FILLING;
+					// references are only added under the lock, a stale count just costs an allocation
+					if (slots[i].image.u && CV_XADD(&slots[i].image.u->refcount, 0) > 1)
+						slots[i].image.release();
+				}
+			}
+
+			try {
+				source->next(i >= 0 ? slots[i].image : overflow);
+			} catch (const std::exception &e) {
+				std::lock_guard<std::mutex> lock(mutex);
+				failure = e.what();
+				if (i >= 0)
+					slots[i].state = Slot::FREE;
+				ready.notify_all();
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			capturedFrames++;
+			uint64_t sequence = nextSequence++;
+			if (i < 0) {
+				droppedFrames++;
+				continue;
+			}
+			slots[i].sequence = sequence;
+			slots[i].state = Slot::READY;
+			ready.notify_one();
+		}
+	}
+
+	ImageSource *source;
+	Mode mode;
+	vector<Slot> slots;
+	uint64_t nextSequence, capturedFrames, droppedFrames;
+	bool running;
+	string failure;
+	mutable std::mutex mutex;
+	std::condition_variable ready;
+	std::thread worker;
 };
 
 #endif /* SRC_IMAGESOURCE_HPP_ */
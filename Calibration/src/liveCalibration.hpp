@@ -0,0 +1,309 @@
+/*
+ * liveCalibration.hpp
+ *
+ * Calibration of the omnidirectional model during the capture: the board is
+ * followed from frame to frame, views are accepted as they cover new parts of
+ * the image, and the model is refined in the background.
+ */
+
+#ifndef SRC_LIVECALIBRATION_HPP_
+#define SRC_LIVECALIBRATION_HPP_
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+#include "opencv2/ccalib/omnidir.hpp"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <limits>
+
+#include "omnidirExt.hpp"
+#include "chessboardDetection.hpp"
+#include "viewSelection.hpp"
+
+using namespace cv;
+using namespace std;
+
+// The corners of the previous frame, moved by their last displacement, are a
+// prediction good enough for cornerSubPix alone. The result is kept if every
+// corner stayed within the search window and the cells still alternate dark
+// and light; otherwise, and when the board was lost, the board is searched in
+// the whole frame with findChessboardCornersPyramid.
+class CornerTracker {
+public:
+	CornerTracker(Size boardSize, int pyramidLevels = 2) :
+			boardSize(boardSize), pyramidLevels(pyramidLevels), lastMotion(std::numeric_limits<double>::infinity()), lastTracked(false) {
+	}
+
+	// Corners of the board in a grey frame, false if the board is not seen
+	bool track(const Mat &gray, vector<Point2f> &corners) {
+		lastTracked = false;
+		if (!previous.empty()) {
+			corners.resize(previous.size());
+			float speed = 0;
+			for (size_t i = 0; i < previous.size(); i++) {
+				corners[i] = previous[i] + velocity[i];
+				speed = std::max(speed, (float) norm(velocity[i]));
+			}
+			vector<Point2f> predicted(corners);
+			int half = std::min(std::max(cvRound(speed) + 5, 5), 21);
+			cornerSubPix(gray, corners, Size(half, half), Size(-1, -1),
+					TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 20, 0.05));
+			lastTracked = inWindow(predicted, corners, half) && alternates(gray, corners);
+		}
+		if (!lastTracked && !findChessboardCornersPyramid(gray, boardSize, corners,
+				CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK, pyramidLevels)) {
+			previous.clear();
+			return false;
+		}
+
+		// displacement from the previous frame, unknown when found again
+		lastMotion = std::numeric_limits<double>::infinity();
+		velocity.assign(corners.size(), Point2f());
+		if (previous.size() == corners.size()) {
+			lastMotion = 0;
+			for (size_t i = 0; i < corners.size(); i++) {
+				velocity[i] = corners[i] - previous[i];
+				lastMotion += norm(velocity[i]);
+			}
+			lastMotion /= corners.size();
+		}
+		previous = corners;
+		return true;
+	}
+
+	// Mean displacement of the corners since the previous frame, in pixels,
+	// infinite when the board was not seen in the previous frame
+	double motion() const {
+		return lastMotion;
+	}
+
+	// Whether the last corners come from the prediction rather than a full search
+	bool tracked() const {
+		return lastTracked;
+	}
+
+	Size boardSize;
+	int pyramidLevels;
+
+private:
+	bool inWindow(const vector<Point2f> &predicted, const vector<Point2f> &corners, int half) const {
+		for (size_t i = 0; i < corners.size(); i++)
+			if (std::abs(corners[i].x - predicted[i].x) > half || std::abs(corners[i].y - predicted[i].y) > half)
+				return false;
+		return true;
+	}
+
+	// The centre of each cell between 4 corners, dark and light in turn
+	bool alternates(const Mat &gray, const vector<Point2f> &corners) const {
+		int w = boardSize.width;
+		vector<int> values[2];
+		for (int y = 0; y + 1 < boardSize.height; y++) {
+			for (int x = 0; x + 1 < w; x++) {
+				Point2f c = (corners[y * w + x] + corners[y * w + x + 1] + corners[(y + 1) * w + x]
+						+ corners[(y + 1) * w + x + 1]) * 0.25f;
+				int u = cvRound(c.x), v = cvRound(c.y);
+				if (u < 0 || v < 0 || u >= gray.cols || v >= gray.rows)
+					return false;
+				values[(x + y) & 1].push_back(gray.at<uchar>(v, u));
+			}
+		}
+		double mean0 = 0, mean1 = 0;
+		for (size_t i = 0; i < values[0].size(); i++)
+			mean0 += values[0][i];
+		for (size_t i = 0; i < values[1].size(); i++)
+			mean1 += values[1][i];
+		mean0 /= values[0].size();
+		mean1 /= values[1].size();
+		if (std::abs(mean0 - mean1) < 20)
+			return false;
+		// each cell on its side of the middle grey
+		double middle = (mean0 + mean1) / 2, sign = mean0 > mean1 ? 1 : -1;
+		int wrong = 0;
+		for (size_t i = 0; i < values[0].size(); i++)
+			wrong += (values[0][i] - middle) * sign <= 0;
+		for (size_t i = 0; i < values[1].size(); i++)
+			wrong += (values[1][i] - middle) * sign >= 0;
+		return wrong * 10 <= (int) (values[0].size() + values[1].size());
+	}
+
+	vector<Point2f> previous, velocity;
+	double lastMotion;
+	bool lastTracked;
+};
+
+// A view is accepted when the board is steady, so that it is sharp, and adds
+// at least minGain bins of the ViewSelector not covered by the views accepted
+// before. Once minViews views are accepted, a thread calibrates every time new
+// views came in: the first time from initializeCalibration, then from the
+// previous model with CALIB_USE_GUESS, so each run only has a few
+// Levenberg-Marquardt iterations to do. Each model is written to `output` in
+// the format read by OmniParam.
+class LiveCalibrator {
+public:
+	LiveCalibrator(Size imageSize, Size boardSize, float squareSize, const string &output) :
+			imageSize(imageSize), boardSize(boardSize), output(output), minViews(8), minGain(3), maxMotion(2),
+			selector(imageSize, boardSize), covered(selector.binCount(), false), calibratedViews(0), runs(0),
+			rms(0), xi(0), converged(false), stopping(false) {
+		for (int y = 0; y < boardSize.height; y++)
+			for (int x = 0; x < boardSize.width; x++)
+				pattern.push_back(Vec3d(x * squareSize, y * squareSize, 0));
+		worker = std::thread(&LiveCalibrator::run, this);
+	}
+
+	// Waits for the calibration in progress
+	~LiveCalibrator() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+	}
+
+	// Keeps the view if it is steady and covers new bins, true if kept
+	bool offer(const vector<Point2f> &corners, double motion) {
+		if (motion > maxMotion || (int) corners.size() != boardSize.area())
+			return false;
+		Mat points;
+		Mat(corners).convertTo(points, CV_64FC2);
+		vector<int> bins;
+		selector.bins(points, bins);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		int gain = 0;
+		for (size_t k = 0; k < bins.size(); k++)
+			gain += !covered[bins[k]];
+		if (gain < minGain)
+			return false;
+		for (size_t k = 0; k < bins.size(); k++)
+			covered[bins[k]] = true;
+		imagePoints.push_back(points);
+		wake.notify_one();
+		return true;
+	}
+
+	int views() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return (int) imagePoints.size();
+	}
+
+	// Latest model, false before the first calibration
+	bool model(Mat &K, Mat &D, double &xi, double &rms, int &views, bool &converged) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (runs == 0)
+			return false;
+		this->K.copyTo(K);
+		this->D.copyTo(D);
+		xi = this->xi;
+		rms = this->rms;
+		views = calibratedViews;
+		converged = this->converged;
+		return true;
+	}
+
+	Size imageSize;
+	Size boardSize;
+	string output;
+	int minViews;     // views of the first calibration
+	int minGain;      // new bins for a view to be accepted
+	double maxMotion; // pixels per frame of a steady board
+
+private:
+	void run() {
+		for (;;) {
+			vector<Mat> views;
+			Mat K, D, xi;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] {
+					return stopping || ((int) imagePoints.size() >= minViews && (int) imagePoints.size() > calibratedViews);
+				});
+				if (stopping)
+					return;
+				views = imagePoints;
+				if (runs > 0) {
+					this->K.copyTo(K);
+					this->D.copyTo(D);
+					xi = (Mat_<double>(1, 1) << this->xi);
+				}
+			}
+
+			// outside of the lock, the capture keeps offering views meanwhile
+			vector<Mat> objectPoints(views.size(), Mat(pattern).clone());
+			vector<Vec3d> rvecs, tvecs;
+			Mat idx;
+			omnidir::CalibrateReport report;
+			int flags = omnidir::CALIB_FIX_SKEW + (K.empty() ? 0 : omnidir::CALIB_USE_GUESS);
+			double newRms;
+			try {
+				newRms = omnidir::calibrate(objectPoints, views, imageSize, K, xi, D, rvecs, tvecs, flags,
+						TermCriteria(3, K.empty() ? 200 : 30, 1e-8), idx, omnidir::SOLVER_LEVENBERG_MARQUARDT, &report);
+			} catch (const cv::Exception &e) {
+				cerr << "Live calibration failed: " << e.what() << endl;
+				std::lock_guard<std::mutex> lock(mutex);
+				calibratedViews = (int) views.size(); // wait for more views before trying again
+				continue;
+			}
+			double newXi = xi.at<double>(0);
+
+			bool stable;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stable = runs > 0 && std::abs(K.at<double>(0, 0) - this->K.at<double>(0, 0)) < 1e-3 * K.at<double>(0, 0)
+						&& std::abs(newXi - this->xi) < 1e-3 * std::max(std::abs(newXi), 1.);
+				K.copyTo(this->K);
+				D.copyTo(this->D);
+				this->xi = newXi;
+				rms = newRms;
+				calibratedViews = (int) views.size();
+				converged = stable;
+				runs++;
+			}
+			cout << "Live calibration " << runs << ": " << idx.total() << "/" << views.size() << " views, rms " << newRms
+					<< ", " << report.iterations << " iterations" << (stable ? ", converged" : "") << endl;
+			save(K, D, newXi, newRms, (int) idx.total());
+		}
+	}
+
+	void save(const Mat &K, const Mat &D, double xi, double rms, int views) const {
+		FileStorage fs(output, FileStorage::WRITE);
+		if (!fs.isOpened()) {
+			cerr << "Failed to write " << output << endl;
+			return;
+		}
+		time_t tt;
+		time(&tt);
+		char buf[1024];
+		strftime(buf, sizeof(buf) - 1, "%c", localtime(&tt));
+		fs << "calibration_time" << buf;
+		fs << "nFrames" << views;
+		fs << "imageSize" << imageSize;
+		fs << "camera_matrix" << K;
+		fs << "distortion_coefficients" << D;
+		fs << "xi" << xi;
+		fs << "rms" << rms;
+	}
+
+	vector<Vec3d> pattern;
+	ViewSelector selector;
+	vector<bool> covered;
+	vector<Mat> imagePoints;
+	int calibratedViews, runs;
+	double rms;
+	Mat K, D;
+	double xi;
+	bool converged, stopping;
+	mutable std::mutex mutex;
+	std::condition_variable wake;
+	std::thread worker;
+};
+
+#endif /* SRC_LIVECALIBRATION_HPP_ */
@@ -0,0 +1,243 @@
+/*
+ * mirrorTracker.hpp
+ *
+ * Edge of the mirror along rays from the optical center, and circle fits of
+ * the edge points, fast enough to follow the mirror at the camera rate.
+ */
+
+#ifndef SRC_MIRRORTRACKER_HPP_
+#define SRC_MIRRORTRACKER_HPP_
+
+#include <opencv2/core.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+// The rays are those of processFrame: one every degreeStep degrees, walked from
+// startRadius towards the center until the first pixel at or above the
+// threshold. The pixel offsets of each ray are tabulated once per frame
+// layout, so the walk is a sequence of loads. The edge is then placed at the
+// maximum of the gradient along the ray, interpolated by a parabola. Once an
+// edge has been found on a ray, the next frame searches a few pixels around it
+// first and walks the whole ray only if the edge is not there.
+class MirrorTracker {
+public:
+	MirrorTracker(Point2d center, double startRadius, int thresh = 44, int degreeStart = -65, int degreeEnd = 180 + 65,
+			int degreeStep = 2) :
+			center(center), startRadius(startRadius), thresh(thresh), band(6), frameSize(0, 0), frameStep(0) {
+		for (int degree = degreeStart; degree < degreeEnd; degree += degreeStep)
+			angles.push_back(degree / 180.0 * CV_PI);
+		previous.assign(angles.size(), -1);
+	}
+
+	// Sub-pixel edge points of a CV_8UC1 frame, and for each ray whether its edge was found
+	void findEdges(const Mat &gray, vector<Point2d> &edges, vector<bool> &found) {
+		CV_Assert(gray.type() == CV_8UC1);
+		if (gray.size() != frameSize || gray.step[0] != frameStep)
+			buildRays(gray.size(), gray.step[0]);
+		edges.clear();
+		found.assign(rays.size(), false);
+		const uchar *data = gray.data;
+		for (size_t k = 0; k < rays.size(); k++) {
+			const Ray &ray = rays[k];
+			int n = (int) ray.offsets.size(), c = -1;
+			if (previous[k] >= 0) {
+				int from = std::max(cvRound(previous[k]) - band, 0), to = std::min(cvRound(previous[k]) + band, n);
+				if (from < n && data[ray.offsets[from]] < thresh)
+					c = crossing(data, ray, from, to);
+			}
+			if (c < 0)
+				c = crossing(data, ray, 0, n);
+			if (c < 0) {
+				previous[k] = -1;
+				continue;
+			}
+			double t = peakGradient(data, ray, c);
+			previous[k] = t;
+			found[k] = true;
+			edges.push_back(ray.origin + t * ray.delta);
+		}
+	}
+
+	// Algebraic circle fit of Taubin, as implemented by Chernov; circle is x, y, r
+	static bool fitTaubin(const vector<Point2d> &points, Vec3d &circle) {
+		int n = (int) points.size();
+		if (n < 3)
+			return false;
+		double meanX = 0, meanY = 0;
+		for (int i = 0; i < n; i++) {
+			meanX += points[i].x;
+			meanY += points[i].y;
+		}
+		meanX /= n;
+		meanY /= n;
+		double Mxx = 0, Myy = 0, Mxy = 0, Mxz = 0, Myz = 0, Mzz = 0;
+		for (int i = 0; i < n; i++) {
+			double x = points[i].x - meanX, y = points[i].y - meanY, z = x * x + y * y;
+			Mxy += x * y;
+			Mxx += x * x;
+			Myy += y * y;
+			Mxz += x * z;
+			Myz += y * z;
+			Mzz += z * z;
+		}
+		Mxx /= n;
+		Myy /= n;
+		Mxy /= n;
+		Mxz /= n;
+		Myz /= n;
+		Mzz /= n;
+
+		// characteristic polynomial, its root from 0 by Newton
+		double Mz = Mxx + Myy, covXY = Mxx * Myy - Mxy * Mxy, varZ = Mzz - Mz * Mz;
+		double A3 = 4 * Mz, A2 = -3 * Mz * Mz - Mzz;
+		double A1 = varZ * Mz + 4 * covXY * Mz - Mxz * Mxz - Myz * Myz;
+		double A0 = Mxz * (Mxz * Myy - Myz * Mxy) + Myz * (Myz * Mxx - Mxz * Mxy) - varZ * covXY;
+		double A22 = A2 + A2, A33 = A3 + A3 + A3;
+		double x = 0, y = A0;
+		for (int iter = 0; iter < 99; iter++) {
+			double dy = A1 + x * (A22 + A33 * x);
+			double xNew = x - y / dy;
+			if (xNew == x || !std::isfinite(xNew))
+				break;
+			double yNew = A0 + xNew * (A1 + xNew * (A2 + xNew * A3));
+			if (std::abs(yNew) >= std::abs(y))
+				break;
+			x = xNew;
+			y = yNew;
+		}
+		double det = x * x - x * Mz + covXY;
+		if (det == 0)
+			return false;
+		double cx = (Mxz * (Myy - x) - Myz * Mxy) / det / 2, cy = (Myz * (Mxx - x) - Mxz * Mxy) / det / 2;
+		circle = Vec3d(cx + meanX, cy + meanY, std::sqrt(cx * cx + cy * cy + Mz));
+		return std::isfinite(circle[2]);
+	}
+
+	// Taubin fit, refitted without the points further than 3 median distances from the circle
+	static bool fitRobust(vector<Point2d> &points, Vec3d &circle) {
+		if (!fitTaubin(points, circle))
+			return false;
+		vector<double> residuals(points.size());
+		for (size_t i = 0; i < points.size(); i++)
+			residuals[i] = std::abs(norm(points[i] - Point2d(circle[0], circle[1])) - circle[2]);
+		vector<double> sorted(residuals);
+		std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+		double limit = 3 * sorted[sorted.size() / 2] + 0.5;
+		vector<Point2d> kept;
+		for (size_t i = 0; i < points.size(); i++)
+			if (residuals[i] <= limit)
+				kept.push_back(points[i]);
+		if (kept.size() == points.size())
+			return true;
+		points.swap(kept);
+		return fitTaubin(points, circle);
+	}
+
+	// Gauss-Newton steps on the distances of the points to the circle, from the
+	// given circle; returns the rms distance
+	static double refine(const vector<Point2d> &points, Vec3d &circle, int iterations = 3) {
+		for (int iter = 0; iter < iterations; iter++) {
+			Matx33d JtJ;
+			Vec3d Jtr;
+			for (size_t i = 0; i < points.size(); i++) {
+				double dx = points[i].x - circle[0], dy = points[i].y - circle[1], d = std::sqrt(dx * dx + dy * dy);
+				if (d == 0)
+					continue;
+				Vec3d J(-dx / d, -dy / d, -1);
+				double r = d - circle[2];
+				JtJ += J * J.t();
+				Jtr += J * r;
+			}
+			Vec3d step;
+			if (!solve(JtJ, -Jtr, step, DECOMP_CHOLESKY))
+				break;
+			circle += step;
+			if (norm(step) < 1e-4)
+				break;
+		}
+		return rms(points, circle);
+	}
+
+	static double rms(const vector<Point2d> &points, const Vec3d &circle) {
+		double sum = 0;
+		for (size_t i = 0; i < points.size(); i++) {
+			double r = norm(points[i] - Point2d(circle[0], circle[1])) - circle[2];
+			sum += r * r;
+		}
+		return points.empty() ? 0 : std::sqrt(sum / points.size());
+	}
+
+	Point2d center;
+	double startRadius;
+	int thresh;
+	int band; // pixels searched around the previous edge of a ray
+
+private:
+	struct Ray {
+		Point2d origin, delta;  // first sample and step towards the center
+		vector<int> offsets;    // byte offset of each sample in the frame
+	};
+
+	void buildRays(Size size, size_t step) {
+		frameSize = size;
+		frameStep = step;
+		rays.assign(angles.size(), Ray());
+		for (size_t k = 0; k < angles.size(); k++) {
+			Ray &ray = rays[k];
+			ray.origin = Point2d(center.x + std::cos(angles[k]) * startRadius, center.y - std::sin(angles[k]) * startRadius);
+			ray.delta = Point2d(-std::cos(angles[k]), std::sin(angles[k]));
+			for (int t = 0; t <= startRadius; t++) {
+				Point2d p = ray.origin + t * ray.delta;
+				int x = cvRound(p.x), y = cvRound(p.y);
+				if (x < 0 || y < 0 || x >= size.width || y >= size.height) {
+					if (ray.offsets.empty())
+						continue; // starts outside of the frame
+					break;
+				}
+				if (ray.offsets.empty())
+					ray.origin = p; // the samples start at the first one in the frame
+				ray.offsets.push_back((int) (y * step + x));
+			}
+		}
+		previous.assign(angles.size(), -1);
+	}
+
+	// First sample of [from, to) at or above the threshold, -1 if none
+	int crossing(const uchar *data, const Ray &ray, int from, int to) const {
+		for (int t = from; t < to; t++)
+			if (data[ray.offsets[t]] >= thresh)
+				return t;
+		return -1;
+	}
+
+	// Position of the steepest rise along the ray around the crossing c
+	double peakGradient(const uchar *data, const Ray &ray, int c) const {
+		int n = (int) ray.offsets.size();
+		int best = -1, bestG = 0;
+		for (int t = std::max(c - 2, 1); t <= std::min(c + 1, n - 2); t++) {
+			int g = data[ray.offsets[t + 1]] - data[ray.offsets[t - 1]];
+			if (best < 0 || g > bestG) {
+				best = t;
+				bestG = g;
+			}
+		}
+		if (best < 2 || best > n - 3)
+			return best < 0 ? c : best;
+		double gm = data[ray.offsets[best]] - data[ray.offsets[best - 2]];
+		double gp = data[ray.offsets[best + 2]] - data[ray.offsets[best]];
+		double den = gm - 2 * bestG + gp;
+		return den < 0 ? best + 0.5 * (gm - gp) / den : best;
+	}
+
+	vector<double> angles;
+	vector<Ray> rays;
+	vector<double> previous; // sub-pixel edge of each ray in the previous frame, -1 if none
+	Size frameSize;
+	size_t frameStep;
+};
+
+#endif /* SRC_MIRRORTRACKER_HPP_ */
@@ -1,4 +1,9 @@
 #include "omnidir.cpp"
+#include "tiledRemap.hpp"
+#include "chessboardDetection.hpp"
+#include "cornerCache.hpp"
+#include "viewSelection.hpp"
+#include "bearingLut.hpp"
 #include "opencv2/ccalib/omnidir.hpp"
 #include "opencv2/core.hpp"
 #include "opencv2/imgproc.hpp"
@@ -6,6 +11,7 @@
 #include "opencv2/highgui.hpp"
 #include <vector>
 #include <iostream>
+#include <algorithm>
 #include <string>
 #include <time.h>
 #include <chrono>
@@ -32,6 +38,16 @@ static void help() {
 					"    [-o <out_camera_params>] # the output filename for intrinsic [and extrinsic] parameters\n"
 					"    [-fs <fix_skew>] # fix skew\n"
 					"    [-fp ] # fix the principal point at the center\n"
+					"    [-lm ] # optimize with Levenberg-Marquardt instead of the scheduled Gauss-Newton\n"
+					"    [-pyr <levels>] # detect the boards on the image reduced <levels> times, refine at full resolution\n"
+					"    [-pyrcompare ] # compare the -pyr detection with the full resolution detection and exit\n"
+					"    [-nocache ] # do not use the detection cache <input_data>.corners.yml.gz\n"
+					"    [-mirror <x> <y> <r>] # mirror circle on the sensor image, pixels outside are not remapped\n"
+					"    [-select <views>] # calibrate on at most <views> views chosen for their coverage, 0 to stop when covered\n"
+					"    [-selectcompare ] # also calibrate on all the views and compare with the selection\n"
+					"    [-lut <step>] # build the pixel to bearing table with a node every <step> pixels, saved to <out_camera_params>.lut\n"
+					"    [-warm <camera_params>] # start from a previous output file, only the images it did not use are detected\n"
+					"                              # (all of them if the file has no used_image_points)\n"
 					"    input_data # input data - text file with a list of the images of the board, which is generated by imagelist_creator");
 	printf("\n %s", usage);
 }
@@ -53,33 +69,108 @@ static void calcChessboardCorners(Size boardSize, double square_width,
 
 static bool detecChessboardCorners(const vector<string>& list,
 		vector<string>& list_detected, vector<Mat>& imagePoints, Size boardSize,
-		Size& imageSize) {
+		Size& imageSize, int pyramidLevels, const string& cacheFilename) {
 	imagePoints.resize(0);
 	list_detected.resize(0);
 	int n_img = (int) list.size();
-	Mat img; //,imgtemp;
+
+	ChessboardDetector detector(boardSize);
+	detector.pyramidLevels = pyramidLevels;
+
+	// detections of unchanged images are taken from the cache, only the others are searched
+	vector<ChessboardDetection> detections(n_img);
+	vector<uint64_t> hashes;
+	vector<string> keys(n_img), missed;
+	vector<int> missedIdx;
+	CornerCache cache;
+	if (!cacheFilename.empty()) {
+		cache.load(cacheFilename);
+		CornerCache::hashFiles(list, hashes);
+	}
+	string mode = format("f%d_p%d", detector.flags, pyramidLevels);
+	for (int i = 0; i < n_img; ++i) {
+		if (!cacheFilename.empty() && hashes[i] != 0) {
+			keys[i] = CornerCache::key(hashes[i], boardSize, mode);
+			if (cache.lookup(keys[i], detections[i]))
+				continue;
+		}
+		missed.push_back(list[i]);
+		missedIdx.push_back(i);
+	}
+	cout << n_img - (int) missed.size() << " detections from the cache, "
+			<< missed.size() << " images to search" << endl;
+
+	// images are decoded and searched in parallel, the results come back in list order
+	if (!missed.empty()) {
+		vector<ChessboardDetection> found;
+		detector.detect(missed, found);
+		for (size_t k = 0; k < missed.size(); ++k) {
+			int i = missedIdx[k];
+			detections[i] = found[k];
+			if (!keys[i].empty())
+				cache.store(keys[i], found[k]);
+		}
+		if (!cacheFilename.empty() && !cache.save(cacheFilename))
+			cerr << "Failed to write the corner cache " << cacheFilename << endl;
+	}
+
 	for (int i = 0; i < n_img; ++i) {
-		Mat points;
 		cout << list[i] << endl;
-		img = imread(list[i], IMREAD_GRAYSCALE);
-		//imgtemp = imread(list[i], IMREAD_COLOR|IMREAD_ANYDEPTH);
-		//cvtColor(imgtemp, img, CV_BGR2GRAY);
-		bool found = findChessboardCorners(img, boardSize, points);
-		if (found) {
-			if (points.type() != CV_64FC2)
-				points.convertTo(points, CV_64FC2);
+		if (!detections[i].imageSize.empty())
+			imageSize = detections[i].imageSize;
+		if (detections[i].found) {
+			Mat points;
+			Mat(detections[i].corners).convertTo(points, CV_64FC2);
 			imagePoints.push_back(points);
 			list_detected.push_back(list[i]);
 		}
 	}
-	if (!img.empty())
-		imageSize = img.size();
 	if (imagePoints.size() < 3)
 		return false;
 	else
 		return true;
 }
 
+// Detects the boards at full resolution and on the pyramid, both refined by cornerSubPix, and prints
+// the distance between the two sets of corners
+static void comparePyramidDetection(const vector<string>& list, Size boardSize, int pyramidLevels) {
+	vector<ChessboardDetection> direct, pyramid;
+	ChessboardDetector detector(boardSize, CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE, true);
+
+	high_resolution_clock::time_point t1 = high_resolution_clock::now();
+	detector.detect(list, direct);
+	high_resolution_clock::time_point t2 = high_resolution_clock::now();
+	detector.pyramidLevels = pyramidLevels;
+	detector.detect(list, pyramid);
+	high_resolution_clock::time_point t3 = high_resolution_clock::now();
+
+	double sum = 0, maxAll = 0;
+	int nCorners = 0, nDirect = 0, nPyramid = 0;
+	for (size_t i = 0; i < list.size(); ++i) {
+		nDirect += direct[i].found;
+		nPyramid += pyramid[i].found;
+		if (!direct[i].found || !pyramid[i].found) {
+			cout << list[i] << ": found " << direct[i].found << " direct, "
+					<< pyramid[i].found << " pyramid" << endl;
+			continue;
+		}
+		double sumImg = 0, maxImg = 0;
+		for (size_t k = 0; k < direct[i].corners.size(); ++k) {
+			double d = norm(direct[i].corners[k] - pyramid[i].corners[k]);
+			sumImg += d;
+			maxImg = std::max(maxImg, d);
+		}
+		cout << list[i] << ": mean " << sumImg / direct[i].corners.size() << " max " << maxImg << " pixels" << endl;
+		sum += sumImg;
+		nCorners += (int) direct[i].corners.size();
+		maxAll = std::max(maxAll, maxImg);
+	}
+	cout << "Boards found: " << nDirect << " direct, " << nPyramid << " pyramid" << endl;
+	cout << "Corner difference: mean " << (nCorners > 0 ? sum / nCorners : 0) << " max " << maxAll << " pixels" << endl;
+	cout << "Detection time: " << duration_cast<milliseconds>(t2 - t1).count() << " ms direct, "
+			<< duration_cast<milliseconds>(t3 - t2).count() << " ms pyramid" << endl << flush;
+}
+
 static bool readStringList(const string& filename, vector<string>& l) {
 	l.resize(0);
 	FileStorage fs(filename, FileStorage::READ);
@@ -98,7 +189,7 @@ static void saveCameraParams(const string & filename, int flags,
 		const Mat& cameraMatrix, const Mat& distCoeffs, const double xi,
 		const vector<Vec3d>& rvecs, const vector<Vec3d>& tvecs,
 		vector<string> detec_list, const Mat& idx, const double rms,
-		const vector<Mat>& imagePoints, Size imageSize) {
+		const Mat& intrinsicErrors, const vector<Mat>& imagePoints, Size imageSize) {
 	FileStorage fs(filename, FileStorage::WRITE);
 
 	time_t tt;
@@ -153,6 +244,10 @@ static void saveCameraParams(const string & filename, int flags,
 
 	fs << "rms" << rms;
 
+	// 3 sigma of fx, fy, s, cx, cy, xi, k1, k2, p1, p2
+	if (!intrinsicErrors.empty())
+		fs << "intrinsic_errors" << intrinsicErrors;
+
 	if (!imagePoints.empty()) {
 		Mat imageMat((int) imagePoints.size(), (int) imagePoints[0].total(),
 		CV_64FC2);
@@ -162,19 +257,72 @@ static void saveCameraParams(const string & filename, int flags,
 			imagei.copyTo(r);
 		}
 		fs << "image_points" << imageMat;
+
+		// points of the views kept by the calibration, in the order of used_imgs, for -warm
+		Mat usedMat((int) idx.total(), (int) imagePoints[0].total(), CV_64FC2);
+		for (int i = 0; i < (int) idx.total(); ++i) {
+			Mat r = usedMat.row(i).reshape(2, usedMat.cols);
+			imagePoints[idx.at<int>(i)].reshape(2, usedMat.cols).copyTo(r);
+		}
+		fs << "used_image_points" << usedMat;
+	}
+}
+
+// Reads the views of a previous calibration to warm start a new one: the intrinsics, and for each used
+// image its name, its detected points and its pose. Files written before used_image_points existed
+// give no points, imagePoints is then left empty and the used images have to be detected again.
+static bool readWarmStart(const string& filename, Mat& K, Mat& D, Mat& xi, Size& imageSize,
+		vector<string>& names, vector<Mat>& imagePoints, vector<Vec3d>& rvecs, vector<Vec3d>& tvecs) {
+	FileStorage fs(filename, FileStorage::READ);
+	if (!fs.isOpened())
+		return false;
+	double _xi = 0;
+	Mat extrinsics, points;
+	fs["camera_matrix"] >> K;
+	fs["distortion_coefficients"] >> D;
+	fs["xi"] >> _xi;
+	fs["imageSize"] >> imageSize;
+	fs["extrinsic_parameters"] >> extrinsics;
+	fs["used_image_points"] >> points;
+	FileNode n = fs["used_imgs"];
+	names.clear();
+	for (FileNodeIterator it = n.begin(); it != n.end(); ++it)
+		names.push_back((string) *it);
+	if (K.empty() || D.empty() || extrinsics.rows != (int) names.size()
+			|| (!points.empty() && points.rows != (int) names.size()))
+		return false;
+	xi = Mat(1, 1, CV_64F, Scalar(_xi));
+	imagePoints.clear();
+	rvecs.clear();
+	tvecs.clear();
+	for (int i = 0; i < (int) names.size(); ++i) {
+		if (!points.empty())
+			imagePoints.push_back(points.row(i).reshape(2, points.cols).clone());
+		rvecs.push_back(Vec3d(extrinsics.ptr<double>(i)));
+		tvecs.push_back(Vec3d(extrinsics.ptr<double>(i) + 3));
 	}
+	return true;
 }
 
 
 int main(int argc, char** argv) {
 	Size boardSize, imageSize, imageSizeUndistort;
 	int flags = 0;
+	int solver = omnidir::SOLVER_SCHEDULED_GN;
+	int pyramidLevels = 0;
+	bool pyramidCompare = false;
+	bool useCache = true;
 	double square_width = 0.0, square_height = 0.0;
 	const char* outputFilename = "out_camera_omni.xml";
 	const char* inputFilename = 0;
+	const char* warmFilename = 0;
+	int selectBudget = -1;
+	int lutStep = 0;
+	bool selectCompare = false;
 	vector<Mat> objectPoints;
 	vector<Mat> imagePoints;
 	double pi=3.141592653589793;
+	Vec3f mirror; // mirror circle (center x, center y, radius), radius 0 if unknown
 
 	if (argc < 2) {
 		help();
@@ -205,6 +353,35 @@ int main(int argc, char** argv) {
 			flags |= omnidir::CALIB_FIX_SKEW;
 		} else if (strcmp(s, "-fp") == 0) {
 			flags |= omnidir::CALIB_FIX_CENTER;
+		} else if (strcmp(s, "-pyr") == 0) {
+			if (sscanf(argv[++i], "%d", &pyramidLevels) != 1
+					|| pyramidLevels < 0)
+				return fprintf(stderr, "Invalid pyramid levels\n"), -1;
+		} else if (strcmp(s, "-pyrcompare") == 0) {
+			pyramidCompare = true;
+		} else if (strcmp(s, "-nocache") == 0) {
+			useCache = false;
+		} else if (strcmp(s, "-lm") == 0) {
+			solver = omnidir::SOLVER_LEVENBERG_MARQUARDT;
+		} else if (strcmp(s, "-mirror") == 0) {
+			if (i + 3 >= argc || sscanf(argv[++i], "%f", &mirror[0]) != 1
+					|| sscanf(argv[++i], "%f", &mirror[1]) != 1
+					|| sscanf(argv[++i], "%f", &mirror[2]) != 1 || mirror[2] <= 0)
+				return fprintf(stderr, "Invalid mirror circle\n"), -1;
+		} else if (strcmp(s, "-select") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &selectBudget) != 1
+					|| selectBudget < 0)
+				return fprintf(stderr, "Invalid view budget\n"), -1;
+		} else if (strcmp(s, "-lut") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &lutStep) != 1
+					|| lutStep <= 0)
+				return fprintf(stderr, "Invalid table step\n"), -1;
+		} else if (strcmp(s, "-selectcompare") == 0) {
+			selectCompare = true;
+		} else if (strcmp(s, "-warm") == 0) {
+			if (i + 1 >= argc)
+				return fprintf(stderr, "Missing warm start file\n"), -1;
+			warmFilename = argv[++i];
 		} else if (s[0] != '-') {
 			inputFilename = s;
 		} else {
@@ -217,30 +394,199 @@ int main(int argc, char** argv) {
 	if (!readStringList(inputFilename, image_list))
 		return fprintf( stderr, "Failed to read image list\n"), -1;
 
+	if (pyramidCompare) {
+		comparePyramidDetection(image_list, boardSize, pyramidLevels > 0 ? pyramidLevels : 2);
+		return 0;
+	}
+
+	// warm start: the views of the previous calibration keep their points and poses, only the
+	// other images of the list are detected, and the optimization starts from the previous model
+	Mat K, D, xi, idx;
+	vector<Vec3d> rvecs, tvecs;
+	vector<string> warm_list, new_list;
+	vector<Mat> warmPoints;
+	string cacheFilename = useCache ? string(inputFilename) + ".corners.yml.gz" : string();
+	if (warmFilename) {
+		if (!readWarmStart(warmFilename, K, D, xi, imageSize, warm_list, warmPoints, rvecs, tvecs))
+			return fprintf(stderr, "Failed to read the warm start file %s\n", warmFilename), -1;
+		if (warmPoints.empty()) {
+			// older file without used_image_points: the used images are detected again, and those
+			// where the board is no longer found are dropped with their pose
+			vector<string> found;
+			detecChessboardCorners(warm_list, found, warmPoints, boardSize, imageSize, pyramidLevels,
+					cacheFilename);
+			vector<Vec3d> om, t;
+			for (size_t i = 0, k = 0; i < warm_list.size() && k < found.size(); ++i) {
+				if (warm_list[i] == found[k]) {
+					om.push_back(rvecs[i]);
+					t.push_back(tvecs[i]);
+					++k;
+				}
+			}
+			warm_list = found;
+			rvecs = om;
+			tvecs = t;
+		}
+		flags |= omnidir::CALIB_USE_GUESS;
+		for (size_t i = 0; i < image_list.size(); ++i)
+			if (find(warm_list.begin(), warm_list.end(), image_list[i]) == warm_list.end())
+				new_list.push_back(image_list[i]);
+		cout << warm_list.size() << " views from " << warmFilename << ", " << new_list.size()
+				<< " new images" << endl;
+	} else {
+		new_list = image_list;
+	}
+
 	// find corners in images
 	// some images may be failed in automatic corner detection, passed cases are in detec_list
-	if (!detecChessboardCorners(image_list, detec_list, imagePoints, boardSize,
-			imageSize))
+	vector<string> new_detected;
+	vector<Mat> newPoints;
+	detecChessboardCorners(new_list, new_detected, newPoints, boardSize,
+			imageSize, pyramidLevels, cacheFilename);
+	detec_list = warm_list;
+	detec_list.insert(detec_list.end(), new_detected.begin(), new_detected.end());
+	imagePoints = warmPoints;
+	imagePoints.insert(imagePoints.end(), newPoints.begin(), newPoints.end());
+	if (imagePoints.size() < 3)
 		return fprintf(stderr, "Not enough corner detected images\n"), -1;
 
 	// calculate object coordinates
 	Mat object;
 	calcChessboardCorners(boardSize, square_width, square_height, object);
+
+	// keep the views that cover the field of view, over the sphere when a previous model is known
+	vector<Mat> allImagePoints = imagePoints;
+	if (selectBudget >= 0) {
+		ViewSelector selector(imageSize, boardSize);
+		if (warmFilename)
+			selector.setModel(K, D, xi.at<double>(0));
+		vector<int> selected;
+		selector.select(imagePoints, selectBudget, selected);
+		vector<string> list;
+		vector<Mat> points;
+		vector<Vec3d> om, t;
+		for (size_t k = 0; k < selected.size(); ++k) {
+			int i = selected[k];
+			list.push_back(detec_list[i]);
+			points.push_back(imagePoints[i]);
+			if (i < (int) rvecs.size()) { // warm views come first and keep their pose
+				om.push_back(rvecs[i]);
+				t.push_back(tvecs[i]);
+			}
+		}
+		cout << selected.size() << " views selected out of " << detec_list.size() << endl;
+		detec_list = list;
+		imagePoints = points;
+		rvecs = om;
+		tvecs = t;
+		if (imagePoints.size() < 3)
+			return fprintf(stderr, "Not enough selected views\n"), -1;
+	}
 	for (int i = 0; i < (int) detec_list.size(); ++i)
 		objectPoints.push_back(object);
 
 
 	// run calibration, some images are discarded in calibration process because they are failed
 	// in initialization. Retained image indexes are in idx variable.
-	Mat K, D, xi, idx;
-	vector<Vec3d> rvecs, tvecs;
 	double _xi, rms;
 	TermCriteria criteria(3, 200, 1e-8);
+	omnidir::CalibrateReport report;
 	rms = omnidir::calibrate(objectPoints, imagePoints, imageSize, K, xi, D,
-			rvecs, tvecs, flags, criteria, idx);
+			rvecs, tvecs, flags, criteria, idx, solver, &report);
+	cout << (solver == omnidir::SOLVER_LEVENBERG_MARQUARDT ? "Levenberg-Marquardt" : "Gauss-Newton")
+			<< ": " << report.iterations << " iterations, "
+			<< report.jacobianEvaluations << " Jacobian evaluations, "
+			<< report.rejectedSteps << " rejected steps, rms " << rms << endl;
+	cout << "Cost history:";
+	for (size_t i = 0; i < report.costHistory.size(); ++i)
+		cout << " " << report.costHistory[i];
+	cout << endl;
+	if (!report.intrinsicErrors.empty()) {
+		const double* e = report.intrinsicErrors.ptr<double>();
+		cout << "Intrinsic errors (3 sigma): fx " << e[0] << " fy " << e[1] << " s " << e[2]
+				<< " cx " << e[3] << " cy " << e[4] << " xi " << e[5] << " k1 " << e[6]
+				<< " k2 " << e[7] << " p1 " << e[8] << " p2 " << e[9] << endl;
+	}
+	cout << flush;
 	_xi = xi.at<double>(0);
+
+	if (selectBudget >= 0) {
+		// the model of the selection on all the detected views, each one located by its pose alone
+		double sum = 0;
+		for (size_t i = 0; i < allImagePoints.size(); ++i) {
+			Vec3d om, t;
+			sum += omnidir::estimatePatternPose(object, allImagePoints[i], K, D, _xi, om, t);
+		}
+		cout << "Selection: rms " << rms << " on " << idx.total() << " views, mean error "
+				<< sum / allImagePoints.size() << " pixels on all the " << allImagePoints.size() << " views" << endl;
+		if (selectCompare) {
+			vector<Mat> allObjectPoints(allImagePoints.size(), object);
+			Mat K2, D2, xi2, idx2;
+			vector<Vec3d> om2, t2;
+			high_resolution_clock::time_point t1 = high_resolution_clock::now();
+			double rmsAll = omnidir::calibrate(allObjectPoints, allImagePoints, imageSize, K2, xi2, D2,
+					om2, t2, flags & ~omnidir::CALIB_USE_GUESS, criteria, idx2, solver, 0);
+			high_resolution_clock::time_point t3 = high_resolution_clock::now();
+			double sumAll = 0;
+			for (size_t i = 0; i < allImagePoints.size(); ++i) {
+				Vec3d om, t;
+				sumAll += omnidir::estimatePatternPose(object, allImagePoints[i], K2, D2, xi2.at<double>(0), om, t);
+			}
+			cout << "All views: rms " << rmsAll << " on " << idx2.total() << " views, mean error "
+					<< sumAll / allImagePoints.size() << " pixels, "
+					<< duration_cast<milliseconds>(t3 - t1).count() << " ms" << endl;
+			cout << "Difference: fx " << K.at<double>(0, 0) - K2.at<double>(0, 0)
+					<< " fy " << K.at<double>(1, 1) - K2.at<double>(1, 1)
+					<< " cx " << K.at<double>(0, 2) - K2.at<double>(0, 2)
+					<< " cy " << K.at<double>(1, 2) - K2.at<double>(1, 2)
+					<< " xi " << _xi - xi2.at<double>(0) << endl << flush;
+		}
+	}
+
 	saveCameraParams(outputFilename, flags, K, D, _xi, rvecs, tvecs, detec_list,
-			idx, rms, imagePoints, imageSize);
+			idx, rms, report.intrinsicErrors, imagePoints, imageSize);
+
+	if (lutStep > 0) {
+		// pixel to bearing table persisted next to the calibration, rebuilt when the model changed
+		string lutFilename = string(outputFilename) + ".lut";
+		BearingLut lut;
+		if (!lut.load(lutFilename, imageSize) || !lut.matches(K, D, _xi, imageSize, lutStep)) {
+			high_resolution_clock::time_point t1 = high_resolution_clock::now();
+			lut.build(K, D, _xi, imageSize, lutStep);
+			high_resolution_clock::time_point t2 = high_resolution_clock::now();
+			cout << "Bearing table " << lut.gridSize << " built in "
+					<< duration_cast<milliseconds>(t2 - t1).count() << " ms" << endl;
+			if (!lut.save(lutFilename))
+				cerr << "Failed to write " << lutFilename << endl;
+		}
+
+		// speed and accuracy against the exact inversion of the model
+		const int nPoints = 1 << 20, nExact = 1 << 14;
+		RNG rng(0x5ca1ab1e);
+		vector<float> px(nPoints), py(nPoints), bx(nPoints), by(nPoints), bz(nPoints);
+		for (int i = 0; i < nPoints; ++i) {
+			px[i] = rng.uniform(0.f, (float) (imageSize.width - 1));
+			py[i] = rng.uniform(0.f, (float) (imageSize.height - 1));
+		}
+		high_resolution_clock::time_point t1 = high_resolution_clock::now();
+		lut.lookup(&px[0], &py[0], nPoints, &bx[0], &by[0], &bz[0]);
+		high_resolution_clock::time_point t2 = high_resolution_clock::now();
+		Mat exactPoints(nExact, 1, CV_64FC2), exact;
+		for (int i = 0; i < nExact; ++i)
+			exactPoints.at<Vec2d>(i) = Vec2d(px[i], py[i]);
+		omnidir::imagePointsToBearings(exactPoints, exact, K, D, _xi);
+		high_resolution_clock::time_point t3 = high_resolution_clock::now();
+		double maxAngle = 0;
+		for (int i = 0; i < nExact; ++i) {
+			Vec3d e = exact.at<Vec3d>(i);
+			double c = (e[0] * bx[i] + e[1] * by[i] + e[2] * bz[i]) / norm(e);
+			maxAngle = std::max(maxAngle, std::acos(std::min(1.0, c)));
+		}
+		cout << "Bearing table: " << duration_cast<nanoseconds>(t2 - t1).count() / (nPoints / 1000) / 1000.0
+				<< " us per 1000 points, exact: "
+				<< duration_cast<nanoseconds>(t3 - t2).count() / (nExact / 1000) / 1000.0
+				<< " us per 1000 points, max error " << maxAngle * 180 / pi << " deg" << endl << flush;
+	}
 
 	int n_img = (int) image_list.size();
 
@@ -263,7 +609,16 @@ int main(int argc, char** argv) {
 
 
 
+	// Same maps, remapped tile by tile in the order of their source footprint.
+	// Outside of the mirror circle the output is left black.
+	TiledRemap tiledRemap(map1, map2, imageSize, INTER_CUBIC, BORDER_CONSTANT, mirror);
+	cout << "Remapped pixels: " << tiledRemap.validRatio() * 100 << " %" << endl << flush;
+	// The tiled output is compared with remap only where it interpolates
+	Mat validMask;
+	tiledRemap.validMask(validMask);
+
 	long accum(0); // variable to measure the running time
+	long accumTiled(0);
 
 
 	for (int i = 0; i < n_img; ++i) {
@@ -284,111 +639,25 @@ int main(int argc, char** argv) {
 		cout << duration << " microseconds" << endl << flush;
 		accum += duration;
 
-		//save images into file
-		imwrite(string("img") + std::to_string(i) + ".bmp", undistorted);
-	}
-	cout << "Average duration = " << accum/n_img << " microseconds" << endl << flush;
-
+		Mat undistortedTiled;
+		t1 = high_resolution_clock::now();
+		tiledRemap.remap(distorted, undistortedTiled);
+		t2 = high_resolution_clock::now();
 
-
-	/* Transform the images from a directory */
-	for (int i = 0; i <= 161; ++i) {
-		// load the images and store them in a vector
-		//Mat distorted = imread(image_list[i], IMREAD_COLOR|IMREAD_ANYDEPTH);
-
-		ostringstream s1;
-		// Create image name files with ascending grabbed image numbers.
-		s1 << "/home/scanvandev/ScanVan/Calibration/img/trajectoryA_fixed" << "/img_0_" << i << ".bmp";
-		string imageFileName(s1.str());
-
-		Mat distorted = imread(imageFileName, IMREAD_COLOR);
-
-		cout << imageFileName << endl << flush;
-
-		// main remapping function that undistort the images
-		cv::remap(distorted, undistorted, map1, map2, INTER_CUBIC, BORDER_CONSTANT);
-
-		ostringstream s2;
-		s2 << "/home/scanvandev/ScanVan/Calibration/img/trajectoryA_fixed/equirectangular" << "/img_equi_0_" << i << ".bmp";
-		string outputFileName(s2.str());
+		duration = duration_cast<microseconds>(t2-t1).count();
+		cout << duration << " microseconds tiled, max difference "
+				<< norm(undistorted, undistortedTiled, NORM_INF, validMask) << endl << flush;
+		accumTiled += duration;
 
 		//save images into file
-		imwrite(outputFileName, undistorted);
-	}
-
-	for (int i = 0; i <= 188; ++i) {
-			// load the images and store them in a vector
-			//Mat distorted = imread(image_list[i], IMREAD_COLOR|IMREAD_ANYDEPTH);
-
-			ostringstream s1;
-			// Create image name files with ascending grabbed image numbers.
-			s1 << "/home/scanvandev/ScanVan/Calibration/img/trajectoryB_auto" << "/img_0_" << i << ".bmp";
-			string imageFileName(s1.str());
-
-			Mat distorted = imread(imageFileName, IMREAD_COLOR);
-
-			cout << imageFileName << endl << flush;
-
-			// main remapping function that undistort the images
-			cv::remap(distorted, undistorted, map1, map2, INTER_CUBIC, BORDER_CONSTANT);
-
-			ostringstream s2;
-			s2 << "/home/scanvandev/ScanVan/Calibration/img/trajectoryB_auto/equirectangular" << "/img_equi_0_" << i << ".bmp";
-			string outputFileName(s2.str());
-
-			//save images into file
-			imwrite(outputFileName, undistorted);
-	}
-
-	for (int i = 0; i <= 183; ++i) {
-				// load the images and store them in a vector
-				//Mat distorted = imread(image_list[i], IMREAD_COLOR|IMREAD_ANYDEPTH);
-
-				ostringstream s1;
-				// Create image name files with ascending grabbed image numbers.
-				s1 << "/home/scanvandev/ScanVan/Calibration/img/trajectoryC_fixed" << "/img_0_" << i << ".bmp";
-				string imageFileName(s1.str());
-
-				Mat distorted = imread(imageFileName, IMREAD_COLOR);
-
-				cout << imageFileName << endl << flush;
-
-				// main remapping function that undistort the images
-				cv::remap(distorted, undistorted, map1, map2, INTER_CUBIC, BORDER_CONSTANT);
-
-				ostringstream s2;
-				s2 << "/home/scanvandev/ScanVan/Calibration/img/trajectoryC_fixed/equirectangular" << "/img_equi_0_" << i << ".bmp";
-				string outputFileName(s2.str());
-
-				//save images into file
-				imwrite(outputFileName, undistorted);
+		imwrite(string("img") + std::to_string(i) + ".bmp", undistorted);
 	}
+	cout << "Average duration = " << accum/n_img << " microseconds" << endl << flush;
+	cout << "Average duration tiled = " << accumTiled/n_img << " microseconds" << endl << flush;
 
-	for (int i = 0; i <= 17; ++i) {
-					// load the images and store them in a vector
-					//Mat distorted = imread(image_list[i], IMREAD_COLOR|IMREAD_ANYDEPTH);
-
-					ostringstream s1;
-					// Create image name files with ascending grabbed image numbers.
-					s1 << "/home/scanvandev/ScanVan/Calibration/img/trajectoryD_calib" << "/img_0_" << i << ".bmp";
-					string imageFileName(s1.str());
-
-					Mat distorted = imread(imageFileName, IMREAD_COLOR);
-
-					cout << imageFileName << endl << flush;
-
-					// main remapping function that undistort the images
-					cv::remap(distorted, undistorted, map1, map2, INTER_CUBIC, BORDER_CONSTANT);
-
-					ostringstream s2;
-					s2 << "/home/scanvandev/ScanVan/Calibration/img/trajectoryD_calib/equirectangular" << "/img_equi_0_" << i << ".bmp";
-					string outputFileName(s2.str());
-
-					//save images into file
-					imwrite(outputFileName, undistorted);
-	}
 
 
+	// Batches of images are converted with equirectConverter
 
 	/*namedWindow("Rectified", WINDOW_NORMAL);
 	for (int i = 0; i < n_img; ++i) {
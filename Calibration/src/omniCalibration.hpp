@@ -36,7 +36,9 @@ using namespace std;
 class OmniParam : public ICalibration
 {
 public:
-	OmniParam() : goodInput(false) {}
+	OmniParam() : goodInput(false) {
+		interpolation = INTER_CUBIC;
+	}
 
 
 	OmniParam(const string inputSettingsFile) : OmniParam() {
@@ -71,11 +73,13 @@ public:
         goodInput = true;
     }
 
-    void rectifyImage(Mat &src, Mat &dst){
+protected:
+    void initRectifyMapFloat(Mat &mapx, Mat &mapy){
 	    Mat R = Mat::eye(3, 3, CV_64F);
 	    R.at<double>(0,0) = 0.5;
 	    R.at<double>(1,1) = 0.5;
-    	cv::omnidir::undistortImage(src, dst, K, D, xi, cv::omnidir::RECTIFY_PERSPECTIVE,cv::noArray(),imageSize,R);
+	    cv::omnidir::initUndistortRectifyMap(K, D, xi, R, cv::noArray(), imageSize, CV_32F, mapx, mapy,
+	    		cv::omnidir::RECTIFY_PERSPECTIVE);
     }
 
 
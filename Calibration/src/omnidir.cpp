@@ -58,6 +58,8 @@
  */
 #include "precomp.hpp"
 #include "opencv2/ccalib/omnidir.hpp"
+#include "omnidirExt.hpp"
+#include "opencv2/core/hal/intrin.hpp"
 #include <fstream>
 #include <iostream>
 namespace cv { namespace
@@ -71,6 +73,189 @@ namespace cv { namespace
         double dxi;
         Matx14d dkp;    // distortion k1,k2,p1,p2
     };
+
+    // Extrinsics and gamma of every view for initializeCalibration, each view is independent
+    class InitializeViewBody : public ParallelLoopBody
+    {
+    public:
+        InitializeViewBody(const std::vector<Mat>& patternPoints, const std::vector<Mat>& imagePoints, double u0, double v0,
+            std::vector<Vec3d>& v_omAll, std::vector<Vec3d>& v_tAll, std::vector<double>& gammaAll) :
+            patternPoints(patternPoints), imagePoints(imagePoints), u0(u0), v0(v0),
+            v_omAll(v_omAll), v_tAll(v_tAll), gammaAll(gammaAll) {}
+
+        void operator()(const Range& range) const
+        {
+            for (int image_idx = range.start; image_idx < range.end; ++image_idx)
+            {
+                cv::Mat objPoints, imgPoints;
+                patternPoints[image_idx].copyTo(objPoints);
+                imagePoints[image_idx].copyTo(imgPoints);
+
+                int n_point = imgPoints.rows * imgPoints.cols;
+                if (objPoints.rows != n_point)
+                    objPoints = objPoints.reshape(3, n_point);
+                if (imgPoints.rows != n_point)
+                    imgPoints = imgPoints.reshape(2, n_point);
+
+                // objectPoints should be 3-channel data, imagePoints should be 2-channel data
+                CV_Assert(objPoints.type() == CV_64FC3 && imgPoints.type() == CV_64FC2 );
+
+                std::vector<cv::Mat> xy, uv;
+                cv::split(objPoints, xy);
+                cv::split(imgPoints, uv);
+
+
+                cv::Mat x = xy[0].reshape(1, n_point), y = xy[1].reshape(1, n_point),
+                        u = uv[0].reshape(1, n_point) - u0, v = uv[1].reshape(1, n_point) - v0;
+
+                cv::Mat sqrRho = u.mul(u) + v.mul(v);
+                // compute extrinsic parameters
+                cv::Mat M(n_point, 6, CV_64F);
+                Mat(-v.mul(x)).copyTo(M.col(0));
+                Mat(-v.mul(y)).copyTo(M.col(1));
+                Mat(u.mul(x)).copyTo(M.col(2));
+                Mat(u.mul(y)).copyTo(M.col(3));
+                Mat(-v).copyTo(M.col(4));
+                Mat(u).copyTo(M.col(5));
+
+                Mat W,U,V;
+                cv::SVD::compute(M, W, U, V,SVD::FULL_UV);
+                V = V.t();
+
+                double miniReprojectError = 1e5;
+                // the signs of r1, r2, r3 are unknown, so they can be flipped.
+                for (int coef = 1; coef >= -1; coef-=2)
+                {
+                    double r11 = V.at<double>(0, 5) * coef;
+                    double r12 = V.at<double>(1, 5) * coef;
+                    double r21 = V.at<double>(2, 5) * coef;
+                    double r22 = V.at<double>(3, 5) * coef;
+                    double t1 = V.at<double>(4, 5) * coef;
+                    double t2 = V.at<double>(5, 5) * coef;
+
+                    Mat roots;
+                    double r31s;
+                    solvePoly(Matx13d(-(r11*r12+r21*r22)*(r11*r12+r21*r22), r11*r11+r21*r21-r12*r12-r22*r22, 1), roots);
+
+                    if (roots.at<Vec2d>(0)[0] > 0)
+                        r31s = sqrt(roots.at<Vec2d>(0)[0]);
+                    else
+                        r31s = sqrt(roots.at<Vec2d>(1)[0]);
+
+                    for (int coef2 = 1; coef2 >= -1; coef2-=2)
+                    {
+                        double r31 = r31s * coef2;
+                        double r32 = -(r11*r12 + r21*r22) / r31;
+
+                        cv::Vec3d r1(r11, r21, r31);
+                        cv::Vec3d r2(r12, r22, r32);
+                        cv::Vec3d t(t1, t2, 0);
+                        double scale = 1 / cv::norm(r1);
+                        r1 = r1 * scale;
+                        r2 = r2 * scale;
+                        t = t * scale;
+
+                        // compute intrisic parameters
+                        // Form equations in Scaramuzza's paper
+                        // A Toolbox for Easily Calibrating Omnidirectional Cameras
+                        Mat A(n_point*2, 3, CV_64F);
+                        Mat((r1[1]*x + r2[1]*y + t[1])/2).copyTo(A.rowRange(0, n_point).col(0));
+                        Mat((r1[0]*x + r2[0]*y + t[0])/2).copyTo(A.rowRange(n_point, 2*n_point).col(0));
+                        Mat(-A.col(0).rowRange(0, n_point).mul(sqrRho)).copyTo(A.col(1).rowRange(0, n_point));
+                        Mat(-A.col(0).rowRange(n_point, 2*n_point).mul(sqrRho)).copyTo(A.col(1).rowRange(n_point, 2*n_point));
+                        Mat(-v).copyTo(A.rowRange(0, n_point).col(2));
+                        Mat(-u).copyTo(A.rowRange(n_point, 2*n_point).col(2));
+
+                        // Operation to avoid bad numerical-condition of A
+                        Vec3d maxA, minA;
+                        for (int j = 0; j < A.cols; j++)
+                        {
+                            cv::minMaxLoc(cv::abs(A.col(j)), &minA[j], &maxA[j]);
+                            A.col(j) = A.col(j) / maxA[j];
+                        }
+
+                        Mat B(n_point*2 , 1, CV_64F);
+                        Mat(v.mul(r1[2]*x + r2[2]*y)).copyTo(B.rowRange(0, n_point));
+                        Mat(u.mul(r1[2]*x + r2[2]*y)).copyTo(B.rowRange(n_point, 2*n_point));
+
+                        Mat res = A.inv(DECOMP_SVD) * B;
+                        res = res.mul(1/Mat(maxA));
+
+                        double gamma = sqrt(res.at<double>(0) / res.at<double>(1));
+                        t[2] = res.at<double>(2);
+
+                        cv::Vec3d r3 = r1.cross(r2);
+
+                        Matx33d R(r1[0], r2[0], r3[0],
+                                  r1[1], r2[1], r3[1],
+                                  r1[2], r2[2], r3[2]);
+                        Vec3d om;
+                        Rodrigues(R, om);
+
+                        // project pattern points to images
+                        Mat projedImgPoints;
+                        Matx33d Kc(gamma, 0, u0, 0, gamma, v0, 0, 0, 1);
+
+                        // reproject error
+                        cv::omnidir::projectPoints(objPoints, projedImgPoints, om, t, Kc, 1, Matx14d(0, 0, 0, 0), cv::noArray());
+                        double reprojectError = omnidir::internal::computeMeanReproErr(imgPoints, projedImgPoints);
+
+                        // if this reproject error is smaller
+                        if (reprojectError < miniReprojectError)
+                        {
+                            miniReprojectError = reprojectError;
+                            v_omAll[image_idx] = om;
+                            v_tAll[image_idx] = t;
+                            gammaAll[image_idx] = gamma;
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        const std::vector<Mat>& patternPoints;
+        const std::vector<Mat>& imagePoints;
+        double u0, v0;
+        std::vector<Vec3d>& v_omAll;
+        std::vector<Vec3d>& v_tAll;
+        std::vector<double>& gammaAll;
+    };
+
+    // Projection of the pattern of every view; with imagePoints, projected receives the residuals
+    // imagePoints - projection instead. Preallocated outputs of the right size are written in place.
+    class ProjectViewsBody : public ParallelLoopBody
+    {
+    public:
+        ProjectViewsBody(const std::vector<Mat>& objectPoints, const std::vector<Vec3d>& omAll, const std::vector<Vec3d>& tAll,
+            const Matx33d& K, const Matx14d& D, double xi, std::vector<Mat>& projected,
+            const std::vector<Mat>* imagePoints = 0) :
+            objectPoints(objectPoints), omAll(omAll), tAll(tAll), K(K), D(D), xi(xi), projected(projected),
+            imagePoints(imagePoints) {}
+
+        void operator()(const Range& range) const
+        {
+            for (int i = range.start; i < range.end; ++i)
+            {
+                // a preallocated output, e.g. a view of a larger matrix, must not be reallocated
+                const uchar* before = projected[i].data;
+                omnidir::projectPoints(objectPoints[i], projected[i], omAll[i], tAll[i], K, xi, D, noArray());
+                CV_Assert(before == 0 || projected[i].data == before);
+                if (imagePoints)
+                    subtract((*imagePoints)[i], projected[i], projected[i]);
+            }
+        }
+
+    private:
+        const std::vector<Mat>& objectPoints;
+        const std::vector<Vec3d>& omAll;
+        const std::vector<Vec3d>& tAll;
+        Matx33d K;
+        Matx14d D;
+        double xi;
+        std::vector<Mat>& projected;
+        const std::vector<Mat>* imagePoints;
+    };
 }}
 
 /////////////////////////////////////////////////////////////////////////////
@@ -568,132 +753,13 @@ void cv::omnidir::internal::initializeCalibration(InputArrayOfArrays patternPoin
 
     K.create(3, 3, CV_64F);
     Mat _K;
-    for (int image_idx = 0; image_idx < n_img; ++image_idx)
-    {
-        cv::Mat objPoints, imgPoints;
-		patternPoints.getMat(image_idx).copyTo(objPoints);
-		imagePoints.getMat(image_idx).copyTo(imgPoints);
-
-		int n_point = imgPoints.rows * imgPoints.cols;
-		if (objPoints.rows != n_point)
-			objPoints = objPoints.reshape(3, n_point);
-		if (imgPoints.rows != n_point)
-			imgPoints = imgPoints.reshape(2, n_point);
-
-        // objectPoints should be 3-channel data, imagePoints should be 2-channel data
-        CV_Assert(objPoints.type() == CV_64FC3 && imgPoints.type() == CV_64FC2 );
-
-        std::vector<cv::Mat> xy, uv;
-        cv::split(objPoints, xy);
-        cv::split(imgPoints, uv);
-
-
-        cv::Mat x = xy[0].reshape(1, n_point), y = xy[1].reshape(1, n_point),
-                u = uv[0].reshape(1, n_point) - u0, v = uv[1].reshape(1, n_point) - v0;
-
-        cv::Mat sqrRho = u.mul(u) + v.mul(v);
-        // compute extrinsic parameters
-        cv::Mat M(n_point, 6, CV_64F);
-        Mat(-v.mul(x)).copyTo(M.col(0));
-        Mat(-v.mul(y)).copyTo(M.col(1));
-        Mat(u.mul(x)).copyTo(M.col(2));
-        Mat(u.mul(y)).copyTo(M.col(3));
-        Mat(-v).copyTo(M.col(4));
-        Mat(u).copyTo(M.col(5));
-
-        Mat W,U,V;
-        cv::SVD::compute(M, W, U, V,SVD::FULL_UV);
-        V = V.t();
-
-        double miniReprojectError = 1e5;
-        // the signs of r1, r2, r3 are unknown, so they can be flipped.
-        for (int coef = 1; coef >= -1; coef-=2)
-        {
-            double r11 = V.at<double>(0, 5) * coef;
-            double r12 = V.at<double>(1, 5) * coef;
-            double r21 = V.at<double>(2, 5) * coef;
-            double r22 = V.at<double>(3, 5) * coef;
-            double t1 = V.at<double>(4, 5) * coef;
-            double t2 = V.at<double>(5, 5) * coef;
-
-            Mat roots;
-            double r31s;
-            solvePoly(Matx13d(-(r11*r12+r21*r22)*(r11*r12+r21*r22), r11*r11+r21*r21-r12*r12-r22*r22, 1), roots);
-
-            if (roots.at<Vec2d>(0)[0] > 0)
-                r31s = sqrt(roots.at<Vec2d>(0)[0]);
-            else
-                r31s = sqrt(roots.at<Vec2d>(1)[0]);
-
-            for (int coef2 = 1; coef2 >= -1; coef2-=2)
-            {
-                double r31 = r31s * coef2;
-                double r32 = -(r11*r12 + r21*r22) / r31;
-
-                cv::Vec3d r1(r11, r21, r31);
-                cv::Vec3d r2(r12, r22, r32);
-                cv::Vec3d t(t1, t2, 0);
-                double scale = 1 / cv::norm(r1);
-                r1 = r1 * scale;
-                r2 = r2 * scale;
-                t = t * scale;
-
-                // compute intrisic parameters
-                // Form equations in Scaramuzza's paper
-                // A Toolbox for Easily Calibrating Omnidirectional Cameras
-                Mat A(n_point*2, 3, CV_64F);
-                Mat((r1[1]*x + r2[1]*y + t[1])/2).copyTo(A.rowRange(0, n_point).col(0));
-                Mat((r1[0]*x + r2[0]*y + t[0])/2).copyTo(A.rowRange(n_point, 2*n_point).col(0));
-                Mat(-A.col(0).rowRange(0, n_point).mul(sqrRho)).copyTo(A.col(1).rowRange(0, n_point));
-                Mat(-A.col(0).rowRange(n_point, 2*n_point).mul(sqrRho)).copyTo(A.col(1).rowRange(n_point, 2*n_point));
-                Mat(-v).copyTo(A.rowRange(0, n_point).col(2));
-                Mat(-u).copyTo(A.rowRange(n_point, 2*n_point).col(2));
-
-                // Operation to avoid bad numerical-condition of A
-                Vec3d maxA, minA;
-                for (int j = 0; j < A.cols; j++)
-                {
-                    cv::minMaxLoc(cv::abs(A.col(j)), &minA[j], &maxA[j]);
-                    A.col(j) = A.col(j) / maxA[j];
-                }
-
-                Mat B(n_point*2 , 1, CV_64F);
-                Mat(v.mul(r1[2]*x + r2[2]*y)).copyTo(B.rowRange(0, n_point));
-                Mat(u.mul(r1[2]*x + r2[2]*y)).copyTo(B.rowRange(n_point, 2*n_point));
-
-                Mat res = A.inv(DECOMP_SVD) * B;
-                res = res.mul(1/Mat(maxA));
-
-                double gamma = sqrt(res.at<double>(0) / res.at<double>(1));
-                t[2] = res.at<double>(2);
-
-                cv::Vec3d r3 = r1.cross(r2);
-
-                Matx33d R(r1[0], r2[0], r3[0],
-                          r1[1], r2[1], r3[1],
-                          r1[2], r2[2], r3[2]);
-                Vec3d om;
-                Rodrigues(R, om);
-
-                // project pattern points to images
-                Mat projedImgPoints;
-                Matx33d Kc(gamma, 0, u0, 0, gamma, v0, 0, 0, 1);
-
-                // reproject error
-                cv::omnidir::projectPoints(objPoints, projedImgPoints, om, t, Kc, 1, Matx14d(0, 0, 0, 0), cv::noArray());
-                double reprojectError = omnidir::internal::computeMeanReproErr(imgPoints, projedImgPoints);
-
-                // if this reproject error is smaller
-                if (reprojectError < miniReprojectError)
-                {
-                    miniReprojectError = reprojectError;
-                    v_omAll[image_idx] = om;
-                    v_tAll[image_idx] = t;
-                    gammaAll[image_idx] = gamma;
-                }
-            }
-        }
+    std::vector<Mat> _patternPoints(n_img), _imagePoints(n_img);
+    for (int i = 0; i < n_img; ++i)
+    {
+        _patternPoints[i] = patternPoints.getMat(i);
+        _imagePoints[i] = imagePoints.getMat(i);
     }
+    parallel_for_(Range(0, n_img), InitializeViewBody(_patternPoints, _imagePoints, u0, v0, v_omAll, v_tAll, gammaAll));
 
     // filter initial results whose reproject errors are too large
     std::vector<double> reProjErrorFilter,v_gammaFilter;
@@ -709,11 +775,12 @@ void cv::omnidir::internal::initializeCalibration(InputArrayOfArrays patternPoin
     _K.convertTo(K, CV_64F);
     std::vector<int> _idx;
     // recompute reproject error using the final gamma
+    std::vector<Mat> projected(n_img);
+    parallel_for_(Range(0, n_img), ProjectViewsBody(_patternPoints, v_omAll, v_tAll,
+        Matx33d(gammaFinal, 0, u0, 0, gammaFinal, v0, 0, 0, 1), Matx14d(0, 0, 0, 0), 1, projected));
     for (int i = 0; i< n_img; i++)
     {
-        Mat _projected;
-        cv::omnidir::projectPoints(patternPoints.getMat(i), _projected, v_omAll[i], v_tAll[i], _K, 1, Matx14d(0, 0, 0, 0), cv::noArray());
-        double _error = omnidir::internal::computeMeanReproErr(imagePoints.getMat(i), _projected);
+        double _error = omnidir::internal::computeMeanReproErr(_imagePoints[i], projected[i]);
         if(_error < 100)
         {
             _idx.push_back(i);
@@ -748,6 +815,299 @@ void cv::omnidir::internal::initializeCalibration(InputArrayOfArrays patternPoin
     xi = 1;
 }
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// cv::omnidir::projectPointsBatch
+
+namespace cv { namespace
+{
+    // Model of projectPoints, with the rotation as a matrix
+    struct ProjectionModel
+    {
+        Matx33d R;
+        Vec3d T;
+        double fx, fy, cx, cy, s, xi, k1, k2, p1, p2;
+    };
+
+    // One point, the same operations as projectPoints: x / (z + xi*|X|) equals Xs[0] / (Xs[2] + xi)
+    template<typename T>
+    inline void projectPoint(const Vec<T, 3>& X, Vec<T, 2>& x, const ProjectionModel& m)
+    {
+        Vec3d Xc = m.R * Vec3d(X[0], X[1], X[2]) + m.T;
+        double inv = 1 / (Xc[2] + m.xi * std::sqrt(Xc.dot(Xc)));
+        double xu = Xc[0] * inv, yu = Xc[1] * inv;
+        double r2 = xu*xu + yu*yu, radial = 1 + m.k1*r2 + m.k2*r2*r2, xy = xu*yu;
+        double xd = xu*radial + 2*m.p1*xy + m.p2*(r2 + 2*xu*xu);
+        double yd = yu*radial + m.p1*(r2 + 2*yu*yu) + 2*m.p2*xy;
+        x = Vec<T, 2>((T)(m.fx*xd + m.s*yd + m.cx), (T)(m.fy*yd + m.cy));
+    }
+
+#if CV_SIMD128
+    inline v_float32x4 v_all(float x) { return v_setall_f32(x); }
+#endif
+#if CV_SIMD128_64F
+    inline v_float64x2 v_all(double x) { return v_setall_f64(x); }
+#endif
+
+    // V::nlanes points at a time in the precision of the points, returns the index of the first point left
+    template<typename V>
+    int projectLanes(const Vec<typename V::lane_type, 3>* src, Vec<typename V::lane_type, 2>* dst, int i, int end,
+        const ProjectionModel& m)
+    {
+        typedef typename V::lane_type T;
+        const int L = V::nlanes;
+        T CV_DECL_ALIGNED(16) bx[L], by[L], bz[L];
+        const V r00 = v_all((T)m.R(0,0)), r01 = v_all((T)m.R(0,1)), r02 = v_all((T)m.R(0,2)),
+                r10 = v_all((T)m.R(1,0)), r11 = v_all((T)m.R(1,1)), r12 = v_all((T)m.R(1,2)),
+                r20 = v_all((T)m.R(2,0)), r21 = v_all((T)m.R(2,1)), r22 = v_all((T)m.R(2,2)),
+                t0 = v_all((T)m.T[0]), t1 = v_all((T)m.T[1]), t2 = v_all((T)m.T[2]),
+                fx = v_all((T)m.fx), fy = v_all((T)m.fy), cx = v_all((T)m.cx), cy = v_all((T)m.cy), s = v_all((T)m.s),
+                xi = v_all((T)m.xi), k1 = v_all((T)m.k1), k2 = v_all((T)m.k2), p1 = v_all((T)m.p1), p2 = v_all((T)m.p2),
+                one = v_all((T)1), two = v_all((T)2);
+        for (; i <= end - L; i += L)
+        {
+            for (int k = 0; k < L; k++)
+            {
+                bx[k] = src[i+k][0];
+                by[k] = src[i+k][1];
+                bz[k] = src[i+k][2];
+            }
+            V X = v_load(bx), Y = v_load(by), Z = v_load(bz);
+            V xc = r00*X + r01*Y + r02*Z + t0;
+            V yc = r10*X + r11*Y + r12*Z + t1;
+            V zc = r20*X + r21*Y + r22*Z + t2;
+            V inv = one / (zc + xi * v_sqrt(xc*xc + yc*yc + zc*zc));
+            V xu = xc*inv, yu = yc*inv;
+            V r2 = xu*xu + yu*yu, radial = one + k1*r2 + k2*r2*r2, xy = xu*yu;
+            V xd = xu*radial + two*p1*xy + p2*(r2 + two*xu*xu);
+            V yd = yu*radial + p1*(r2 + two*yu*yu) + two*p2*xy;
+            v_store(bx, fx*xd + s*yd + cx);
+            v_store(by, fy*yd + cy);
+            for (int k = 0; k < L; k++)
+                dst[i+k] = Vec<T, 2>(bx[k], by[k]);
+        }
+        return i;
+    }
+
+    inline int projectLanes(const Vec3f* src, Vec2f* dst, int i, int end, const ProjectionModel& m)
+    {
+#if CV_SIMD128
+        return projectLanes<v_float32x4>(src, dst, i, end, m);
+#else
+        (void)src; (void)dst; (void)end; (void)m;
+        return i;
+#endif
+    }
+
+    inline int projectLanes(const Vec3d* src, Vec2d* dst, int i, int end, const ProjectionModel& m)
+    {
+#if CV_SIMD128_64F
+        return projectLanes<v_float64x2>(src, dst, i, end, m);
+#else
+        (void)src; (void)dst; (void)end; (void)m;
+        return i;
+#endif
+    }
+
+    // Blocks of points projected by the threads, SIMD lanes first and the remainder one by one
+    template<typename T>
+    class ProjectPointsBatchBody : public ParallelLoopBody
+    {
+    public:
+        enum { blockSize = 4096 };
+
+        ProjectPointsBatchBody(const Vec<T, 3>* src, Vec<T, 2>* dst, int n, const ProjectionModel& m) :
+            src(src), dst(dst), n(n), m(m) {}
+
+        void operator()(const Range& range) const
+        {
+            int start = range.start * blockSize, end = std::min(n, range.end * blockSize);
+            int i = projectLanes(src, dst, start, end, m);
+            for (; i < end; i++)
+                projectPoint(src[i], dst[i], m);
+        }
+
+    private:
+        const Vec<T, 3>* src;
+        Vec<T, 2>* dst;
+        int n;
+        ProjectionModel m;
+    };
+}}
+
+void cv::omnidir::projectPointsBatch(InputArray objectPoints, OutputArray imagePoints, InputArray rvec, InputArray tvec,
+    InputArray K, double xi, InputArray D)
+{
+    CV_Assert(objectPoints.type() == CV_64FC3 || objectPoints.type() == CV_32FC3);
+    CV_Assert((rvec.depth() == CV_64F || rvec.depth() == CV_32F) && rvec.total() == 3);
+    CV_Assert((tvec.depth() == CV_64F || tvec.depth() == CV_32F) && tvec.total() == 3);
+    CV_Assert((K.type() == CV_64F || K.type() == CV_32F) && K.size() == Size(3,3));
+    CV_Assert((D.type() == CV_64F || D.type() == CV_32F) && D.total() == 4);
+
+    Mat src = objectPoints.getMat();
+    if (!src.isContinuous())
+        src = src.clone();
+    imagePoints.create(src.size(), CV_MAKETYPE(src.depth(), 2));
+    Mat dst = imagePoints.getMat();
+    int n = (int)src.total();
+
+    ProjectionModel m;
+    Vec3d om;
+    Matx33d Kc;
+    Vec4d kp;
+    rvec.getMat().reshape(1, 3).convertTo(om, CV_64F);
+    tvec.getMat().reshape(1, 3).convertTo(m.T, CV_64F);
+    K.getMat().convertTo(Kc, CV_64F);
+    D.getMat().reshape(1, 4).convertTo(kp, CV_64F);
+    Rodrigues(om, m.R);
+    m.fx = Kc(0,0); m.fy = Kc(1,1); m.cx = Kc(0,2); m.cy = Kc(1,2); m.s = Kc(0,1);
+    m.xi = xi; m.k1 = kp[0]; m.k2 = kp[1]; m.p1 = kp[2]; m.p2 = kp[3];
+
+    Range blocks(0, (n + ProjectPointsBatchBody<float>::blockSize - 1) / ProjectPointsBatchBody<float>::blockSize);
+    if (src.depth() == CV_32F)
+        parallel_for_(blocks, ProjectPointsBatchBody<float>(src.ptr<Vec3f>(), dst.ptr<Vec2f>(), n, m));
+    else
+        parallel_for_(blocks, ProjectPointsBatchBody<double>(src.ptr<Vec3d>(), dst.ptr<Vec2d>(), n, m));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// cv::omnidir::imagePointsToBearings
+
+void cv::omnidir::imagePointsToBearings(InputArray imagePoints, OutputArray bearings, InputArray K, InputArray D,
+    double xi)
+{
+    CV_Assert(imagePoints.type() == CV_64FC2 || imagePoints.type() == CV_32FC2);
+    int n = (int)imagePoints.total();
+    Mat points = imagePoints.getMat().reshape(2, n), undistorted;
+    if (points.depth() == CV_32F)
+        points.convertTo(points, CV_64F);
+    cv::omnidir::undistortPoints(points, undistorted, K, D, Matx<double, 1, 1>(xi), noArray());
+
+    // the undistorted normalized points, lifted to the unit sphere
+    Mat _bearings(n, 1, CV_64FC3);
+    for (int i = 0; i < n; i++)
+    {
+        Vec2d pu = undistorted.at<Vec2d>(i);
+        double r2 = pu[0]*pu[0] + pu[1]*pu[1];
+        double a = r2 + 1, b = 2*xi*r2, c = r2*xi*xi - 1;
+        double Zs = (-b + std::sqrt(std::max(b*b - 4*a*c, 0.0))) / (2*a);
+        _bearings.at<Vec3d>(i) = Vec3d(pu[0]*(Zs + xi), pu[1]*(Zs + xi), Zs);
+    }
+    _bearings.reshape(3, imagePoints.getMat().rows).convertTo(bearings, CV_MAKETYPE(imagePoints.depth(), 3));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// cv::omnidir::estimatePatternPose
+
+double cv::omnidir::estimatePatternPose(InputArray patternPoints, InputArray imagePoints, InputArray K, InputArray D,
+    double xi, OutputArray om, OutputArray T, int iterations)
+{
+    CV_Assert(patternPoints.type() == CV_64FC3 && imagePoints.type() == CV_64FC2);
+    int n = (int)imagePoints.total();
+    CV_Assert(n >= 4 && (int)patternPoints.total() == n);
+
+    Mat objPoints = patternPoints.getMat().reshape(3, n), imgPoints = imagePoints.getMat().reshape(2, n);
+    Mat _K, _D;
+    K.getMat().convertTo(_K, CV_64F);
+    D.getMat().convertTo(_D, CV_64F);
+
+    std::vector<Vec3d> bearings;
+    cv::omnidir::imagePointsToBearings(imgPoints, bearings, _K, _D, xi);
+
+    // the pattern coordinates are centred and scaled to a mean distance of sqrt(2) (Hartley), so that
+    // they are of the same order as the unit bearings in the linear system
+    Vec2d mean(0, 0);
+    for (int i = 0; i < n; i++)
+    {
+        Vec3d P = objPoints.at<Vec3d>(i);
+        mean += Vec2d(P[0], P[1]);
+    }
+    mean *= 1.0 / n;
+    double meanDistance = 0;
+    for (int i = 0; i < n; i++)
+    {
+        Vec3d P = objPoints.at<Vec3d>(i);
+        meanDistance += cv::norm(Vec2d(P[0], P[1]) - mean);
+    }
+    meanDistance /= n;
+    double s = meanDistance > 0 ? std::sqrt(2.0) / meanDistance : 1;
+    Matx33d N(s, 0, -s*mean[0],
+              0, s, -s*mean[1],
+              0, 0, 1);
+
+    // homography between the normalized pattern plane and the bearings, from b x (H p) = 0
+    Mat A = Mat::zeros(3*n, 9, CV_64F);
+    for (int i = 0; i < n; i++)
+    {
+        Vec3d P = objPoints.at<Vec3d>(i), b = bearings[i];
+        double p[3] = {s*(P[0] - mean[0]), s*(P[1] - mean[1]), 1};
+        for (int j = 0; j < 3; j++)
+        {
+            double* r0 = A.ptr<double>(3*i), *r1 = A.ptr<double>(3*i+1), *r2 = A.ptr<double>(3*i+2);
+            r0[3+j] = -b[2]*p[j]; r0[6+j] =  b[1]*p[j];
+            r1[j]   =  b[2]*p[j]; r1[6+j] = -b[0]*p[j];
+            r2[j]   = -b[1]*p[j]; r2[3+j] =  b[0]*p[j];
+        }
+    }
+    Mat w, u, vt;
+    SVD::compute(A, w, u, vt, SVD::FULL_UV);
+    Matx33d H = Matx33d(vt.ptr<double>(8)) * N; // back to the pattern coordinates
+
+    // the pattern is in front of the bearings and the rotation columns are unit vectors
+    double sign = 0;
+    for (int i = 0; i < n; i++)
+    {
+        Vec3d P = objPoints.at<Vec3d>(i);
+        sign += bearings[i].dot(H * Vec3d(P[0], P[1], 1));
+    }
+    Vec3d h1(H(0,0), H(1,0), H(2,0)), h2(H(0,1), H(1,1), H(2,1)), h3(H(0,2), H(1,2), H(2,2));
+    double scale = (sign < 0 ? -2 : 2) / (cv::norm(h1) + cv::norm(h2));
+    h1 *= scale; h2 *= scale;
+    Vec3d r3 = h1.cross(h2);
+    Matx33d R(h1[0], h2[0], r3[0],
+              h1[1], h2[1], r3[1],
+              h1[2], h2[2], r3[2]);
+    Matx33d Ur, Vtr;
+    Matx31d Wr;
+    SVD::compute(R, Wr, Ur, Vtr);
+    R = Ur * Vtr;
+    Vec3d _om, _T = h3 * scale;
+    Rodrigues(R, _om);
+
+    // Gauss-Newton on the pose only; a step is kept only if it lowers the reprojection error
+    Mat projected, jacobian;
+    cv::omnidir::projectPoints(objPoints, projected, _om, _T, _K, xi, _D, jacobian);
+    Mat E = imgPoints.reshape(1, 2*n) - projected.reshape(1, 2*n);
+    double cost = E.dot(E);
+    for (int iter = 0; iter < iterations; iter++)
+    {
+        Mat Jpose = jacobian.colRange(0, 6);
+        Mat delta;
+        if (!solve(Jpose.t() * Jpose, Jpose.t() * E, delta, DECOMP_CHOLESKY))
+            break;
+        Vec3d om1 = _om + Vec3d(delta.ptr<double>(0)), T1 = _T + Vec3d(delta.ptr<double>(3));
+        Mat projected1, jacobian1;
+        cv::omnidir::projectPoints(objPoints, projected1, om1, T1, _K, xi, _D, jacobian1);
+        Mat E1 = imgPoints.reshape(1, 2*n) - projected1.reshape(1, 2*n);
+        double cost1 = E1.dot(E1);
+        if (!(cost1 < cost))
+            break;
+        _om = om1;
+        _T = T1;
+        cost = cost1;
+        projected = projected1;
+        jacobian = jacobian1;
+        E = E1;
+        if (norm(delta) < 1e-10)
+            break;
+    }
+
+    double error = omnidir::internal::computeMeanReproErr(imgPoints, projected);
+
+    Mat(_om).convertTo(om, CV_64F);
+    Mat(_T).convertTo(T, CV_64F);
+    return error;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// cv::omnidir::internal::initializeStereoCalibration
 
@@ -850,91 +1210,608 @@ void cv::omnidir::internal::initializeStereoCalibration(InputArrayOfArrays objec
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
-/// cv::omnidir::internal::computeJacobian
+/// Block-arrow normal equations
 
-void cv::omnidir::internal::computeJacobian(InputArrayOfArrays objectPoints, InputArrayOfArrays imagePoints,
-    InputArray parameters, Mat& JTJ_inv, Mat& JTE, int flags, double epsilon)
+namespace cv { namespace
 {
-    CV_Assert(!objectPoints.empty() && objectPoints.type() == CV_64FC3);
-    CV_Assert(!imagePoints.empty() && imagePoints.type() == CV_64FC2);
+    // The normal equations of the calibration are block-arrow shaped: a 6x6 block U per view (om, T),
+    // the block V of the global parameters (intrinsics, and the relative pose for stereo), and the
+    // coupling W between each view and the globals. The views are eliminated with a Schur complement,
+    // so a step costs O(n) in the number of views instead of the O(n^3) of a dense inverse.
+    struct BlockArrowSystem
+    {
+        int nViews, viewOffset;         // view i owns the parameters viewOffset+6*i .. viewOffset+6*i+5
+        std::vector<int> globalParam;   // parameter index of each global unknown
+        std::vector<Mat> U, W, ea;      // per view: 6x6, 6 x nGlobal, 6x1
+        std::vector<Mat> Vi, ebi;       // per view contributions to V and eb
+        Mat V, eb;                      // nGlobal x nGlobal, nGlobal x 1
 
-    int n = (int)objectPoints.total();
+        BlockArrowSystem() : nViews(0), viewOffset(0) {}
 
-    Mat JTJ = Mat::zeros(10 + 6*n, 10 + 6*n, CV_64F);
-    JTJ_inv = Mat::zeros(10 + 6*n, 10 + 6*n, CV_64F);
-    JTE = Mat::zeros(10 + 6*n, 1, CV_64F);
+        void create(int n, int _viewOffset, const std::vector<int>& _globalParam)
+        {
+            nViews = n;
+            viewOffset = _viewOffset;
+            globalParam = _globalParam;
+            U.resize(n);
+            W.resize(n);
+            ea.resize(n);
+            Vi.resize(n);
+            ebi.resize(n);
+        }
 
-    int nPointsAll = 0;
-    for (int i = 0; i < n; ++i)
+        int total() const
+        {
+            return viewOffset + 6*nViews + (int)globalParam.size();
+        }
+
+        // Sets the blocks of view i from its residuals e and their Jacobians Jv (view parameters) and
+        // Jg (globals). The blocks are reused from one iteration to the next.
+        void setView(int i, const Mat& Jv, const Mat& Jg, const Mat& e)
+        {
+            gemm(Jv, Jv, 1, noArray(), 0, U[i], GEMM_1_T);
+            gemm(Jv, Jg, 1, noArray(), 0, W[i], GEMM_1_T);
+            gemm(Jv, e, 1, noArray(), 0, ea[i], GEMM_1_T);
+            gemm(Jg, Jg, 1, noArray(), 0, Vi[i], GEMM_1_T);
+            gemm(Jg, e, 1, noArray(), 0, ebi[i], GEMM_1_T);
+        }
+
+        // Sums the global blocks in view order, so the result does not depend on the threads
+        void merge()
+        {
+            int nGlobal = (int)globalParam.size();
+            V = Mat::zeros(nGlobal, nGlobal, CV_64F);
+            eb = Mat::zeros(nGlobal, 1, CV_64F);
+            for (int i = 0; i < nViews; ++i)
+            {
+                V += Vi[i];
+                eb += ebi[i];
+            }
+        }
+
+        // Solves (JTJ + epsilon) G = JTE over the free parameters of idx, where epsilon is added to every
+        // element of the reduced JTJ as the dense solver did. This is a rank-one update of JTJ, applied with
+        // Sherman-Morrison on top of the block solve. G has the full parameter length, zero when fixed.
+        // lambda > 0 scales the diagonal of JTJ by 1 + lambda (Levenberg-Marquardt damping).
+        void solve(const std::vector<int>& idx, double epsilon, Mat& G, double lambda = 0) const
+        {
+            std::vector<int> freeGlobal;
+            for (int k = 0; k < (int)globalParam.size(); ++k)
+            {
+                if (idx[globalParam[k]])
+                    freeGlobal.push_back(k);
+            }
+            int nf = (int)freeGlobal.size();
+
+            // right hand sides: JTE and the ones vector of the rank-one update
+            Mat S(nf, nf, CV_64F), r(nf, 2, CV_64F);
+            for (int a = 0; a < nf; ++a)
+            {
+                for (int b = 0; b < nf; ++b)
+                    S.at<double>(a, b) = V.at<double>(freeGlobal[a], freeGlobal[b]);
+                r.at<double>(a, 0) = eb.at<double>(freeGlobal[a]);
+                r.at<double>(a, 1) = 1;
+                S.at<double>(a, a) *= 1 + lambda;
+            }
+
+            std::vector<Mat> Uinv(nViews), Wf(nViews), ea2(nViews);
+            for (int i = 0; i < nViews; ++i)
+            {
+                Mat Ui = U[i];
+                if (lambda > 0)
+                {
+                    Ui = U[i].clone();
+                    for (int k = 0; k < 6; ++k)
+                        Ui.at<double>(k, k) *= 1 + lambda;
+                }
+                Uinv[i] = Ui.inv(DECOMP_CHOLESKY);
+                Wf[i].create(6, nf, CV_64F);
+                for (int a = 0; a < nf; ++a)
+                    W[i].col(freeGlobal[a]).copyTo(Wf[i].col(a));
+                hconcat(ea[i], Mat::ones(6, 1, CV_64F), ea2[i]);
+
+                Mat WTUinv = Wf[i].t() * Uinv[i];
+                S -= WTUinv * Wf[i];
+                r -= WTUinv * ea2[i];
+            }
+
+            Mat z;
+            cv::solve(S, r, z, DECOMP_LU);
+
+            Mat x = Mat::zeros(total(), 2, CV_64F);
+            for (int a = 0; a < nf; ++a)
+                z.row(a).copyTo(x.row(globalParam[freeGlobal[a]]));
+            for (int i = 0; i < nViews; ++i)
+            {
+                Mat xv = Uinv[i] * (ea2[i] - Wf[i] * z);
+                xv.copyTo(x.rowRange(viewOffset + 6*i, viewOffset + 6*i + 6));
+            }
+
+            double sx = sum(x.col(0))[0], sy = sum(x.col(1))[0];
+            G = x.col(0) - (epsilon * sx / (1 + epsilon * sy)) * x.col(1);
+        }
+
+        // Diagonal of the inverse of JTJ reduced to the free parameters of idx, full length with zeros
+        // for the fixed ones. The globals come from the inverse of the Schur complement
+        // S = V - sum W_i' U_i^-1 W_i, a view block i is U_i^-1 + U_i^-1 W_i S^-1 W_i' U_i^-1.
+        // The dense JTJ is never formed. With globalsOnly the view blocks are left to zero.
+        void covarianceDiagonal(const std::vector<int>& idx, Mat& d, bool globalsOnly) const
+        {
+            std::vector<int> freeGlobal;
+            for (int k = 0; k < (int)globalParam.size(); ++k)
+            {
+                if (idx[globalParam[k]])
+                    freeGlobal.push_back(k);
+            }
+            int nf = (int)freeGlobal.size();
+
+            Mat S(nf, nf, CV_64F);
+            for (int a = 0; a < nf; ++a)
+                for (int b = 0; b < nf; ++b)
+                    S.at<double>(a, b) = V.at<double>(freeGlobal[a], freeGlobal[b]);
+            std::vector<Mat> Uinv(nViews), Wf(nViews);
+            for (int i = 0; i < nViews; ++i)
+            {
+                Uinv[i] = U[i].inv(DECOMP_CHOLESKY);
+                Wf[i].create(6, nf, CV_64F);
+                for (int a = 0; a < nf; ++a)
+                    W[i].col(freeGlobal[a]).copyTo(Wf[i].col(a));
+                S -= Wf[i].t() * Uinv[i] * Wf[i];
+            }
+            Mat Sinv = S.inv(DECOMP_LU);
+
+            d = Mat::zeros(total(), 1, CV_64F);
+            for (int a = 0; a < nf; ++a)
+                d.at<double>(globalParam[freeGlobal[a]]) = Sinv.at<double>(a, a);
+            if (globalsOnly)
+                return;
+            for (int i = 0; i < nViews; ++i)
+            {
+                Mat UinvW = Uinv[i] * Wf[i];
+                Mat block = Uinv[i] + UinvW * Sinv * UinvW.t();
+                block.diag().copyTo(d.rowRange(viewOffset + 6*i, viewOffset + 6*i + 6));
+            }
+        }
+
+        // Full length JTE and diagonal of JTJ
+        void gradient(Mat& g) const
+        {
+            g = Mat::zeros(total(), 1, CV_64F);
+            for (int i = 0; i < nViews; ++i)
+                ea[i].copyTo(g.rowRange(viewOffset + 6*i, viewOffset + 6*i + 6));
+            for (int k = 0; k < (int)globalParam.size(); ++k)
+                g.at<double>(globalParam[k]) = eb.at<double>(k);
+        }
+
+        void diagonal(Mat& d) const
+        {
+            d = Mat::zeros(total(), 1, CV_64F);
+            for (int i = 0; i < nViews; ++i)
+                U[i].diag().copyTo(d.rowRange(viewOffset + 6*i, viewOffset + 6*i + 6));
+            for (int k = 0; k < (int)globalParam.size(); ++k)
+                d.at<double>(globalParam[k]) = V.at<double>(k, k);
+        }
+
+        // Dense JTJ and JTE over all the parameters, for the covariance estimation
+        void toDense(Mat& JTJ, Mat& JTE) const
+        {
+            int nGlobal = (int)globalParam.size();
+            JTJ = Mat::zeros(total(), total(), CV_64F);
+            JTE = Mat::zeros(total(), 1, CV_64F);
+            for (int i = 0; i < nViews; ++i)
+            {
+                int v = viewOffset + 6*i;
+                U[i].copyTo(JTJ(Rect(v, v, 6, 6)));
+                ea[i].copyTo(JTE.rowRange(v, v + 6));
+                for (int k = 0; k < nGlobal; ++k)
+                {
+                    W[i].col(k).copyTo(JTJ(Rect(globalParam[k], v, 1, 6)));
+                    Mat(W[i].col(k).t()).copyTo(JTJ(Rect(v, globalParam[k], 6, 1)));
+                }
+            }
+            for (int a = 0; a < nGlobal; ++a)
+            {
+                JTE.at<double>(globalParam[a]) = eb.at<double>(a);
+                for (int b = 0; b < nGlobal; ++b)
+                    JTJ.at<double>(globalParam[a], globalParam[b]) = V.at<double>(a, b);
+            }
+        }
+    };
+
+    // Data of the normal equations kept across the iterations: the points reshaped once, the
+    // projection and Jacobian buffers of every view, and the block system.
+    struct NormalEquationsWorkspace
     {
-        nPointsAll += (int)objectPoints.getMat(i).total();
+        std::vector<Mat> objectPoints, imagePoints1, imagePoints2;  // N x 1, continuous
+        std::vector<Mat> imgProj1, imgProj2, jacobian1, jacobian2;
+        std::vector<Mat> JV, JG, E;     // stacked residuals of each view and their Jacobians
+        std::vector<double> viewCost;   // squared norm of the residuals of each view
+        double cost;
+        BlockArrowSystem system;
+
+        NormalEquationsWorkspace() : cost(0) {}
+
+        void create(InputArrayOfArrays _objectPoints, InputArrayOfArrays _imagePoints1,
+            InputArrayOfArrays _imagePoints2 = noArray())
+        {
+            int n = (int)_objectPoints.total();
+            objectPoints.resize(n);
+            imagePoints1.resize(n);
+            imagePoints2.resize(_imagePoints2.empty() ? 0 : n);
+            for (int i = 0; i < n; ++i)
+            {
+                Mat objPoints = _objectPoints.getMat(i).clone();
+                Mat imgPoints = _imagePoints1.getMat(i).clone();
+                objectPoints[i] = objPoints.reshape(3, objPoints.rows*objPoints.cols);
+                imagePoints1[i] = imgPoints.reshape(2, imgPoints.rows*imgPoints.cols);
+                if (!_imagePoints2.empty())
+                {
+                    imgPoints = _imagePoints2.getMat(i).clone();
+                    imagePoints2[i] = imgPoints.reshape(2, imgPoints.rows*imgPoints.cols);
+                }
+            }
+            imgProj1.resize(n);
+            imgProj2.resize(n);
+            jacobian1.resize(n);
+            jacobian2.resize(n);
+            JV.resize(n);
+            JG.resize(n);
+            E.resize(n);
+            viewCost.resize(n);
+        }
+
+        double sumCost() const
+        {
+            double sum = 0;
+            for (int i = 0; i < (int)viewCost.size(); ++i)
+                sum += viewCost[i];
+            return sum;
+        }
+    };
+
+    class NormalEquationsBody : public ParallelLoopBody
+    {
+    public:
+        NormalEquationsBody(NormalEquationsWorkspace& _ws, const Mat& _parameters, bool _jacobian = true) :
+            ws(_ws), parameters(_parameters), jacobian(_jacobian)
+        {
+            int n = (int)ws.objectPoints.size();
+            const double *para = parameters.ptr<double>();
+            K = Matx33d(para[6*n], para[6*n+2], para[6*n+3],
+                0,    para[6*n+1], para[6*n+4],
+                0,    0,  1);
+            D = Matx14d(para[6*n+6], para[6*n+7], para[6*n+8], para[6*n+9]);
+            xi = para[6*n+5];
+        }
+
+        void operator()(const Range& range) const
+        {
+            for (int i = range.start; i < range.end; i++)
+            {
+                Mat om = parameters.colRange(i*6, i*6+3);
+                Mat T = parameters.colRange(i*6+3, (i+1)*6);
+                if (!jacobian)
+                {
+                    omnidir::projectPoints(ws.objectPoints[i], ws.imgProj1[i], om, T, K, xi, D, noArray());
+                    subtract(ws.imagePoints1[i], ws.imgProj1[i], ws.E[i]);
+                    ws.viewCost[i] = norm(ws.E[i], NORM_L2SQR);
+                    continue;
+                }
+                omnidir::projectPoints(ws.objectPoints[i], ws.imgProj1[i], om, T, K, xi, D, ws.jacobian1[i]);
+                subtract(ws.imagePoints1[i], ws.imgProj1[i], ws.E[i]);
+                ws.viewCost[i] = norm(ws.E[i], NORM_L2SQR);
+
+                const Mat& J = ws.jacobian1[i];
+                ws.system.setView(i, J.colRange(0, 6), J.colRange(6, 16), ws.E[i].reshape(1, J.rows));
+            }
+        }
+
+    private:
+        NormalEquationsWorkspace& ws;
+        Mat parameters;
+        bool jacobian;  // false: residuals and cost only
+        Matx33d K;
+        Matx14d D;
+        double xi;
+    };
+
+    class NormalEquationsStereoBody : public ParallelLoopBody
+    {
+    public:
+        NormalEquationsStereoBody(NormalEquationsWorkspace& _ws, const Mat& _parameters) : ws(_ws), parameters(_parameters)
+        {
+            int n_img = (int)ws.objectPoints.size();
+            int offset1 = (n_img + 1) * 6;
+            int offset2 = offset1 + 10;
+            const double *para = parameters.ptr<double>();
+            K1 = Matx33d(para[offset1], para[offset1+2], para[offset1+3],
+                0,    para[offset1+1], para[offset1+4],
+                0,    0,  1);
+            D1 = Matx14d(para[offset1+6], para[offset1+7], para[offset1+8], para[offset1+9]);
+            xi1 = para[offset1+5];
+
+            K2 = Matx33d(para[offset2], para[offset2+2], para[offset2+3],
+                0,    para[offset2+1], para[offset2+4],
+                0,    0,  1);
+            D2 = Matx14d(para[offset2+6], para[offset2+7], para[offset2+8], para[offset2+9]);
+            xi2 = para[offset2+5];
+
+            om = parameters.colRange(0, 3);
+            T = parameters.colRange(3, 6);
+        }
+
+        void operator()(const Range& range) const
+        {
+            for (int i = range.start; i < range.end; i++)
+            {
+                int n_points = (int)ws.objectPoints[i].total();
+                Mat om1 = parameters.colRange((1 + i) * 6, (1 + i) * 6 + 3);
+                Mat T1 = parameters.colRange((1 + i) * 6 + 3, (i + 1) * 6 + 6);
+
+                // rows 0..2N-1 are the left image, 2N..4N-1 the right image
+                Mat& JV = ws.JV[i];
+                Mat& JG = ws.JG[i];
+                Mat& E = ws.E[i];
+                JV.create(4*n_points, 6, CV_64F);
+                JG.create(4*n_points, 26, CV_64F);
+                E.create(4*n_points, 1, CV_64F);
+                JG.setTo(0);
+
+                // jacobian for left image
+                Mat& jacobian1 = ws.jacobian1[i];
+                cv::omnidir::projectPoints(ws.objectPoints[i], ws.imgProj1[i], om1, T1, K1, xi1, D1, jacobian1);
+                Mat E1 = E.rowRange(0, 2*n_points).reshape(2, n_points);
+                subtract(ws.imagePoints1[i], ws.imgProj1[i], E1);
+                jacobian1.colRange(0, 6).copyTo(JV.rowRange(0, 2*n_points));
+                jacobian1.colRange(6, 16).copyTo(JG(Rect(6, 0, 10, 2*n_points)));
+
+                //jacobian for right image
+                Mat om2, T2, dom2dom1, dom2dT1, dom2dom, dom2dT, dT2dom1, dT2dT1, dT2dom, dT2dT;
+                cv::omnidir::internal::compose_motion(om1, T1, om, T, om2, T2, dom2dom1, dom2dT1, dom2dom, dom2dT, dT2dom1, dT2dT1, dT2dom, dT2dT);
+                Mat& jacobian2 = ws.jacobian2[i];
+                cv::omnidir::projectPoints(ws.objectPoints[i], ws.imgProj2[i], om2, T2, K2, xi2, D2, jacobian2);
+                Mat E2 = E.rowRange(2*n_points, 4*n_points).reshape(2, n_points);
+                subtract(ws.imagePoints2[i], ws.imgProj2[i], E2);
+
+                // chain rule through the composed motion, [om2 T2] with respect to [om1 T1] and [om T]
+                Mat dPose2dPose1(6, 6, CV_64F), dPose2dPose(6, 6, CV_64F);
+                dom2dom1.copyTo(dPose2dPose1(Rect(0, 0, 3, 3)));
+                dom2dT1.copyTo(dPose2dPose1(Rect(3, 0, 3, 3)));
+                dT2dom1.copyTo(dPose2dPose1(Rect(0, 3, 3, 3)));
+                dT2dT1.copyTo(dPose2dPose1(Rect(3, 3, 3, 3)));
+                dom2dom.copyTo(dPose2dPose(Rect(0, 0, 3, 3)));
+                dom2dT.copyTo(dPose2dPose(Rect(3, 0, 3, 3)));
+                dT2dom.copyTo(dPose2dPose(Rect(0, 3, 3, 3)));
+                dT2dT.copyTo(dPose2dPose(Rect(3, 3, 3, 3)));
+                Mat JV2 = JV.rowRange(2*n_points, 4*n_points);
+                Mat JG2 = JG(Rect(0, 2*n_points, 6, 2*n_points));
+                gemm(jacobian2.colRange(0, 6), dPose2dPose1, 1, noArray(), 0, JV2);
+                gemm(jacobian2.colRange(0, 6), dPose2dPose, 1, noArray(), 0, JG2);
+                jacobian2.colRange(6, 16).copyTo(JG(Rect(16, 2*n_points, 10, 2*n_points)));
+
+                ws.viewCost[i] = norm(E, NORM_L2SQR);
+                ws.system.setView(i, JV, JG, E);
+            }
+        }
+
+    private:
+        NormalEquationsWorkspace& ws;
+        Mat parameters;
+        Matx33d K1, K2;
+        Matx14d D1, D2;
+        double xi1, xi2;
+        Mat om, T;
+    };
+
+    // Builds the normal equations of the views in parallel; the per-view blocks are merged in view order.
+    void computeNormalEquations(NormalEquationsWorkspace& ws, InputArray parameters)
+    {
+        int n = (int)ws.objectPoints.size();
+        std::vector<int> globalParam(10);
+        for (int k = 0; k < 10; ++k)
+            globalParam[k] = 6*n + k;
+        ws.system.create(n, 0, globalParam);
+
+        parallel_for_(Range(0, n), NormalEquationsBody(ws, parameters.getMat().reshape(1, 1)));
+        ws.system.merge();
+        ws.cost = ws.sumCost();
     }
 
-    Mat J = Mat::zeros(2*nPointsAll, 10+6*n, CV_64F);
-    Mat exAll = Mat::zeros(2*nPointsAll, 10+6*n, CV_64F);
-    double *para = parameters.getMat().ptr<double>();
-    Matx33d K(para[6*n], para[6*n+2], para[6*n+3],
-        0,    para[6*n+1], para[6*n+4],
-        0,    0,  1);
-    Matx14d D(para[6*n+6], para[6*n+7], para[6*n+8], para[6*n+9]);
-    double xi = para[6*n+5];
-    for (int i = 0; i < n; i++)
+    // Sum of the squared reprojection errors, without the Jacobian
+    double computeCost(NormalEquationsWorkspace& ws, InputArray parameters)
     {
-        Mat objPoints, imgPoints, om, T;
-		objectPoints.getMat(i).copyTo(objPoints);
-		imagePoints.getMat(i).copyTo(imgPoints);
-		objPoints = objPoints.reshape(3, objPoints.rows*objPoints.cols);
-		imgPoints = imgPoints.reshape(2, imgPoints.rows*imgPoints.cols);
+        int n = (int)ws.objectPoints.size();
+        parallel_for_(Range(0, n), NormalEquationsBody(ws, parameters.getMat().reshape(1, 1), false));
+        return ws.sumCost();
+    }
 
-        om = parameters.getMat().colRange(i*6, i*6+3);
-        T = parameters.getMat().colRange(i*6+3, (i+1)*6);
-        Mat imgProj, jacobian;
-        omnidir::projectPoints(objPoints, imgProj, om, T, K, xi, D, jacobian);
-        Mat projError = imgPoints - imgProj;
+    void computeNormalEquationsStereo(NormalEquationsWorkspace& ws, InputArray parameters)
+    {
+        int n_img = (int)ws.objectPoints.size();
+        int offset1 = (n_img + 1) * 6;
 
-        // The intrinsic part of Jacobian
-        Mat JIn(jacobian.rows, 10, CV_64F);
-        Mat JEx(jacobian.rows, 6, CV_64F);
+        // globals: om, T between the cameras, then the intrinsics of both cameras
+        std::vector<int> globalParam(26);
+        for (int k = 0; k < 6; ++k)
+            globalParam[k] = k;
+        for (int k = 0; k < 20; ++k)
+            globalParam[6 + k] = offset1 + k;
+        ws.system.create(n_img, 6, globalParam);
 
-        jacobian.colRange(6, 16).copyTo(JIn);
-        jacobian.colRange(0, 6).copyTo(JEx);
+        parallel_for_(Range(0, n_img), NormalEquationsStereoBody(ws, parameters.getMat().reshape(1, 1)));
+        ws.system.merge();
+        ws.cost = ws.sumCost();
+    }
 
-        JTJ(Rect(6*n, 6*n, 10, 10)) = JTJ(Rect(6*n, 6*n, 10, 10)) + JIn.t()*JIn;
+    // Levenberg-Marquardt with Marquardt's diagonal scaling and Nielsen's damping update. A step is kept
+    // when it decreases the cost; the ratio of the actual to the predicted decrease drives the damping.
+    void optimizeLevenbergMarquardt(NormalEquationsWorkspace& ws, const std::vector<int>& idx, TermCriteria criteria,
+        Mat& param, omnidir::CalibrateReport& report)
+    {
+        const int maxCount = (criteria.type & TermCriteria::COUNT) ? criteria.maxCount : 1000;
+        const double eps = (criteria.type & TermCriteria::EPS) ? criteria.epsilon : 0;
 
-        JTJ(Rect(i*6, i*6, 6, 6)) = JEx.t() * JEx;
+        computeNormalEquations(ws, param);
+        report.jacobianEvaluations++;
+        double cost = ws.cost;
+        report.costHistory.push_back(cost);
 
-        Mat JExTIn = JEx.t() * JIn;
+        double lambda = 1e-3, nu = 2;
+        int iter = 0;
+        while (iter < maxCount)
+        {
+            ++iter;
+            Mat h, g, d;
+            ws.system.solve(idx, 0, h, lambda);
+            ws.system.gradient(g);
+            ws.system.diagonal(d);
+
+            // decrease of the cost predicted by the linearization: h'(JTE + lambda*diag(JTJ)*h)
+            double predicted = h.dot(g) + lambda * h.dot(d.mul(h));
+            Mat candidate = param + h.t();
+            double newCost = computeCost(ws, candidate);
+            report.costEvaluations++;
+            double rho = predicted > 0 ? (cost - newCost) / predicted : -1;
+
+            if (rho > 0)
+            {
+                double decrease = cost > 0 ? (cost - newCost) / cost : 0;
+                double change = norm(h) / norm(param);
+                param = candidate;
+                cost = newCost;
+                report.costHistory.push_back(cost);
+                lambda *= std::max(1.0 / 3, 1 - std::pow(2 * rho - 1, 3));
+                nu = 2;
+                if (decrease <= eps || change <= eps)
+                    break;
+                computeNormalEquations(ws, param);
+                report.jacobianEvaluations++;
+            }
+            else
+            {
+                report.rejectedSteps++;
+                lambda *= nu;
+                nu *= 2;
+                // no step decreases the cost any more, the minimum is reached up to rounding
+                if (lambda > 1e16)
+                    break;
+            }
+        }
+        report.iterations = iter;
+    }
+
+    // Initialization of calibrate with CALIB_USE_GUESS: the intrinsics are kept, the views of the
+    // given poses (the first ones) start from them and the others are located by estimatePatternPose.
+    // Views that the intrinsics cannot explain are filtered out as in initializeCalibration.
+    void initializeFromGuess(const std::vector<Mat>& patternPoints, const std::vector<Mat>& imagePoints,
+        const Matx33d& K, const Matx14d& D, double xi, InputArrayOfArrays omGuess, InputArrayOfArrays tGuess,
+        std::vector<Vec3d>& omAll, std::vector<Vec3d>& tAll, Mat& idx)
+    {
+        int nGuess = 0;
+        std::vector<Vec3d> omIn, tIn;
+        if (!omGuess.empty() && !tGuess.empty())
+        {
+            nGuess = std::min((int)omGuess.total(), (int)tGuess.total());
+            if (omGuess.kind() == _InputArray::STD_VECTOR_MAT)
+            {
+                for (int i = 0; i < nGuess; i++)
+                {
+                    Vec3d om, T;
+                    omGuess.getMat(i).reshape(1, 3).convertTo(om, CV_64F);
+                    tGuess.getMat(i).reshape(1, 3).convertTo(T, CV_64F);
+                    omIn.push_back(om);
+                    tIn.push_back(T);
+                }
+            }
+            else
+            {
+                omGuess.getMat().reshape(3, nGuess).convertTo(omIn, CV_64FC3);
+                tGuess.getMat().reshape(3, nGuess).convertTo(tIn, CV_64FC3);
+            }
+            nGuess = std::min(nGuess, (int)patternPoints.size());
+        }
+
+        std::vector<int> _idx;
+        omAll.clear();
+        tAll.clear();
+        for (int i = 0; i < (int)patternPoints.size(); i++)
+        {
+            Vec3d om, T;
+            double error;
+            if (i < nGuess)
+            {
+                om = omIn[i];
+                T = tIn[i];
+                Mat projected;
+                cv::omnidir::projectPoints(patternPoints[i], projected, om, T, K, xi, D, noArray());
+                error = omnidir::internal::computeMeanReproErr(imagePoints[i], projected);
+            }
+            else
+            {
+                error = cv::omnidir::estimatePatternPose(patternPoints[i], imagePoints[i], K, D, xi, om, T);
+            }
+            if (error < 100)
+            {
+                _idx.push_back(i);
+                omAll.push_back(om);
+                tAll.push_back(T);
+            }
+        }
+        Mat(_idx).reshape(1, 1).copyTo(idx);
+    }
+
+    // estimateUncertainties restricted to the intrinsics: the same rms, standard error and 3 sigma errors,
+    // the covariance coming from the Schur complement of the view blocks instead of the dense inverse.
+    // errors holds fx, fy, s, cx, cy, xi, k1, k2, p1, p2, zero when fixed.
+    void estimateIntrinsicUncertainties(NormalEquationsWorkspace& ws, const Mat& parameters, const std::vector<int>& idx,
+        Mat& errors, Vec2d& std_error, double& rms)
+    {
+        int n = (int)ws.objectPoints.size();
+        computeNormalEquations(ws, parameters);
 
-        JExTIn.copyTo(JTJ(Rect(6*n, i*6, 10, 6)));
+        Mat reprojError;
+        vconcat(ws.E, reprojError);
+        meanStdDev(reprojError, noArray(), std_error);
+        std_error *= sqrt((double)reprojError.total()/((double)reprojError.total() - 1.0));
 
-        Mat(JIn.t()*JEx).copyTo(JTJ(Rect(i*6, 6*n, 6, 10)));
+        Mat sigma_x;
+        meanStdDev(reprojError.reshape(1,1), noArray(), sigma_x);
+        sigma_x *= sqrt(2.0*(double)reprojError.total()/(2.0*(double)reprojError.total() - 1.0));
+        double s = sigma_x.at<double>(0);
 
-        JTE(Rect(0, 6*n, 1, 10)) = JTE(Rect(0, 6*n,1, 10)) + JIn.t() * projError.reshape(1, 2*(int)projError.total());
-        JTE(Rect(0, i*6, 1, 6)) = JEx.t() * projError.reshape(1, 2*(int)projError.total());
+        Mat d;
+        ws.system.covarianceDiagonal(idx, d, true);
+        sqrt(d.rowRange(6*n, 6*n + 10), errors);
+        errors = 3 * s * errors;
 
-        //int nPoints = objectPoints.getMat(i).total();
-        //JIn.copyTo(J(Rect(6*n, i*nPoints*2, 10, nPoints*2)));
-        //JEx.copyTo(J(Rect(6*i, i*nPoints*2, 6, nPoints*2)));
-        //projError.reshape(1, 2*projError.rows).copyTo(exAll.rowRange(i*2*nPoints, (i+1)*2*nPoints));
+        rms = sqrt(ws.cost / (double)reprojError.total());
     }
-    //JTJ = J.t()*J;
-    //JTE = J.t()*exAll;
+}}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// cv::omnidir::internal::computeJacobian
+
+void cv::omnidir::internal::computeJacobian(InputArrayOfArrays objectPoints, InputArrayOfArrays imagePoints,
+    InputArray parameters, Mat& JTJ_inv, Mat& JTE, int flags, double epsilon)
+{
+    CV_Assert(!objectPoints.empty() && objectPoints.type() == CV_64FC3);
+    CV_Assert(!imagePoints.empty() && imagePoints.type() == CV_64FC2);
+
+    int n = (int)objectPoints.total();
+
+    // the optimization solves the block system directly, the dense inverse is only for the uncertainties
+    NormalEquationsWorkspace ws;
+    ws.create(objectPoints, imagePoints);
+    computeNormalEquations(ws, parameters);
+    Mat JTJ;
+    ws.system.toDense(JTJ, JTE);
+
     std::vector<int> _idx(6*n+10, 1);
     flags2idx(flags, _idx, n);
 
     subMatrix(JTJ, JTJ, _idx, _idx);
     subMatrix(JTE, JTE, std::vector<int>(1, 1), _idx);
-    // in case JTJ is singular
-	//SVD svd(JTJ, SVD::NO_UV);
-	//double cond = svd.w.at<double>(0)/svd.w.at<double>(5);
-
-	//if (cond_JTJ.needed())
-	//{
-	//	cond_JTJ.create(1, 1, CV_64F);
-	//	cond_JTJ.getMat().at<double>(0) = cond;
-	//}
 
-    //double epsilon = 1e-4*std::exp(cond);
     JTJ_inv = Mat(JTJ+epsilon).inv();
 }
 
@@ -946,77 +1823,17 @@ void cv::omnidir::internal::computeJacobianStereo(InputArrayOfArrays objectPoint
     CV_Assert(!imagePoints2.empty() && imagePoints2.type() == CV_64FC2);
     CV_Assert((imagePoints1.total() == imagePoints2.total()) && (imagePoints1.total() == objectPoints.total()));
 
-    // compute Jacobian matrix by naive way
     int n_img = (int)objectPoints.total();
-    int n_points = (int)objectPoints.getMat(0).total();
-    Mat J = Mat::zeros(4 * n_points * n_img, 20 + 6 * (n_img + 1), CV_64F);
-    Mat exAll = Mat::zeros(4 * n_points * n_img, 1, CV_64F);
-    double *para = parameters.getMat().ptr<double>();
-    int offset1 = (n_img + 1) * 6;
-    int offset2 = offset1 + 10;
-    Matx33d K1(para[offset1], para[offset1+2], para[offset1+3],
-        0,    para[offset1+1], para[offset1+4],
-        0,    0,  1);
-    Matx14d D1(para[offset1+6], para[offset1+7], para[offset1+8], para[offset1+9]);
-    double xi1 = para[offset1+5];
 
-    Matx33d K2(para[offset2], para[offset2+2], para[offset2+3],
-        0,    para[offset2+1], para[offset2+4],
-        0,    0,  1);
-    Matx14d D2(para[offset2+6], para[offset2+7], para[offset2+8], para[offset2+9]);
-    double xi2 = para[offset2+5];
-
-    Mat om = parameters.getMat().reshape(1, 1).colRange(0, 3);
-    Mat T = parameters.getMat().reshape(1, 1).colRange(3, 6);
-
-    for (int i = 0; i < n_img; i++)
-    {
-        Mat objPointsi, imgPoints1i, imgPoints2i, om1, T1;
-        objectPoints.getMat(i).copyTo(objPointsi);
-        imagePoints1.getMat(i).copyTo(imgPoints1i);
-        imagePoints2.getMat(i).copyTo(imgPoints2i);
-        objPointsi = objPointsi.reshape(3, objPointsi.rows*objPointsi.cols);
-        imgPoints1i = imgPoints1i.reshape(2, imgPoints1i.rows*imgPoints1i.cols);
-        imgPoints2i = imgPoints2i.reshape(2, imgPoints2i.rows*imgPoints2i.cols);
-
-        om1 = parameters.getMat().reshape(1, 1).colRange((1 + i) * 6, (1 + i) * 6 + 3);
-        T1 = parameters.getMat().reshape(1, 1).colRange((1 + i) * 6 + 3, (i + 1) * 6 + 6);
-
-
-        Mat imgProj1, imgProj2, jacobian1, jacobian2;
-
-        // jacobian for left image
-        cv::omnidir::projectPoints(objPointsi, imgProj1, om1, T1, K1, xi1, D1, jacobian1);
-        Mat projError1 = imgPoints1i - imgProj1;
-        //Mat JIn1(jacobian1.rows, 10, CV_64F);
-        //Mat JEx1(jacobian1.rows, 6, CV_64F);
-        jacobian1.colRange(6, 16).copyTo(J(Rect(6*(n_img+1), i*n_points*4, 10, n_points*2)));
-        jacobian1.colRange(0, 6).copyTo(J(Rect(6+i*6, i*n_points*4, 6, n_points*2)));
-        projError1.reshape(1, 2*n_points).copyTo(exAll.rowRange(i*4*n_points, (i*4+2)*n_points));
-
-        //jacobian for right image
-        Mat om2, T2, dom2dom1, dom2dT1, dom2dom, dom2dT, dT2dom1, dT2dT1, dT2dom, dT2dT;
-        cv::omnidir::internal::compose_motion(om1, T1, om, T, om2, T2, dom2dom1, dom2dT1, dom2dom, dom2dT, dT2dom1, dT2dT1, dT2dom, dT2dT);
-        cv::omnidir::projectPoints(objPointsi, imgProj2, om2, T2, K2, xi2, D2, jacobian2);
-        Mat projError2 = imgPoints2i - imgProj2;
-        projError2.reshape(1, 2*n_points).copyTo(exAll.rowRange((i*4+2)*n_points, (i*4+4)*n_points));
-        Mat dxrdom = jacobian2.colRange(0, 3) * dom2dom + jacobian2.colRange(3, 6) * dT2dom;
-        Mat dxrdT = jacobian2.colRange(0, 3) * dom2dT + jacobian2.colRange(3, 6) * dT2dT;
-        Mat dxrdom1 = jacobian2.colRange(0, 3) * dom2dom1 + jacobian2.colRange(3, 6) * dT2dom1;
-        Mat dxrdT1 = jacobian2.colRange(0, 3) * dom2dT1 + jacobian2.colRange(3, 6) * dT2dT1;
-
-        dxrdom.copyTo(J(Rect(0, (i*4+2)*n_points, 3, n_points*2)));
-        dxrdT.copyTo(J(Rect(3, (i*4+2)*n_points, 3, n_points*2)));
-        dxrdom1.copyTo(J(Rect(6+i*6, (i*4+2)*n_points, 3, n_points*2)));
-        dxrdT1.copyTo(J(Rect(6+i*6+3, (i*4+2)*n_points, 3, n_points*2)));
-        jacobian2.colRange(6, 16).copyTo(J(Rect(6*(n_img+1)+10, (4*i+2)*n_points, 10, n_points*2)));
-    }
+    NormalEquationsWorkspace ws;
+    ws.create(objectPoints, imagePoints1, imagePoints2);
+    computeNormalEquationsStereo(ws, parameters);
+    Mat JTJ;
+    ws.system.toDense(JTJ, JTE);
 
     std::vector<int> _idx(6*(n_img+1)+20, 1);
     flags2idxStereo(flags, _idx, n_img);
 
-    Mat JTJ = J.t()*J;
-    JTE = J.t()*exAll;
     subMatrix(JTJ, JTJ, _idx, _idx);
     subMatrix(JTE, JTE, std::vector<int>(1, 1), _idx);
 
@@ -1072,6 +1889,15 @@ double cv::omnidir::calibrate(InputArrayOfArrays patternPoints, InputArrayOfArra
     InputOutputArray K, InputOutputArray xi, InputOutputArray D, OutputArrayOfArrays omAll, OutputArrayOfArrays tAll,
     int flags, TermCriteria criteria, OutputArray idx)
 {
+    return cv::omnidir::calibrate(patternPoints, imagePoints, size, K, xi, D, omAll, tAll, flags, criteria, idx,
+        SOLVER_SCHEDULED_GN, 0);
+}
+
+double cv::omnidir::calibrate(InputArrayOfArrays patternPoints, InputArrayOfArrays imagePoints, Size size,
+    InputOutputArray K, InputOutputArray xi, InputOutputArray D, OutputArrayOfArrays omAll, OutputArrayOfArrays tAll,
+    int flags, TermCriteria criteria, OutputArray idx, int solver, CalibrateReport* report)
+{
+    CV_Assert(solver == SOLVER_SCHEDULED_GN || solver == SOLVER_LEVENBERG_MARQUARDT);
     CV_Assert(!patternPoints.empty() && !imagePoints.empty() && patternPoints.total() == imagePoints.total());
     CV_Assert((patternPoints.type() == CV_64FC3 && imagePoints.type() == CV_64FC2) ||
         (patternPoints.type() == CV_32FC3 && imagePoints.type() == CV_32FC2));
@@ -1102,7 +1928,20 @@ double cv::omnidir::calibrate(InputArrayOfArrays patternPoints, InputArrayOfArra
     Matx33d _K;
     Matx14d _D;
     Mat _idx;
-    cv::omnidir::internal::initializeCalibration(_patternPoints, _imagePoints, size, _omAll, _tAll, _K, _xi, _idx);
+    if (flags & CALIB_USE_GUESS)
+    {
+        CV_Assert(!K.empty() && !D.empty() && !xi.empty());
+        K.getMat().convertTo(_K, CV_64F);
+        D.getMat().reshape(1, 1).convertTo(_D, CV_64F);
+        Mat xi_in;
+        xi.getMat().convertTo(xi_in, CV_64F);
+        _xi = xi_in.at<double>(0);
+        initializeFromGuess(_patternPoints, _imagePoints, _K, _D, _xi, omAll, tAll, _omAll, _tAll, _idx);
+    }
+    else
+    {
+        cv::omnidir::internal::initializeCalibration(_patternPoints, _imagePoints, size, _omAll, _tAll, _K, _xi, _idx);
+    }
     std::vector<Mat> _patternPointsTmp = _patternPoints;
     std::vector<Mat> _imagePointsTmp = _imagePoints;
 
@@ -1118,27 +1957,36 @@ double cv::omnidir::calibrate(InputArrayOfArrays patternPoints, InputArrayOfArra
     int n = (int)_patternPoints.size();
     Mat finalParam(1, 10 + 6*n, CV_64F);
     Mat currentParam(1, 10 + 6*n, CV_64F);
-    cv::omnidir::internal::encodeParameters(_K, _omAll, _tAll, Mat::zeros(1,4,CV_64F), _xi, currentParam);
+    // _D is zero unless given with CALIB_USE_GUESS
+    cv::omnidir::internal::encodeParameters(_K, _omAll, _tAll, Mat(_D), _xi, currentParam);
+
+    std::vector<int> paramIdx(6*n+10, 1);
+    cv::omnidir::internal::flags2idx(flags, paramIdx, n);
+    NormalEquationsWorkspace ws;
+    ws.create(_patternPoints, _imagePoints);
+    CalibrateReport _report;
 
     // optimization
     const double alpha_smooth = 0.01;
     //const double thresh_cond = 1e6;
     double change = 1;
-    for(int iter = 0; ; ++iter)
+    for(int iter = 0; solver == SOLVER_SCHEDULED_GN; ++iter)
     {
         if ((criteria.type == 1 && iter >= criteria.maxCount)  ||
             (criteria.type == 2 && change <= criteria.epsilon) ||
             (criteria.type == 3 && (change <= criteria.epsilon || iter >= criteria.maxCount)))
             break;
         double alpha_smooth2 = 1 - std::pow(1 - alpha_smooth, (double)iter + 1.0);
-        Mat JTJ_inv, JTError;
 		double epsilon = 0.01 * std::pow(0.9, (double)iter/10);
-        cv::omnidir::internal::computeJacobian(_patternPoints, _imagePoints, currentParam, JTJ_inv, JTError, flags, epsilon);
+        computeNormalEquations(ws, currentParam);
+        _report.jacobianEvaluations++;
+        _report.iterations++;
+        _report.costHistory.push_back(ws.cost);
 
         // Gauss - Newton
-        Mat G = alpha_smooth2*JTJ_inv * JTError;
-
-        omnidir::internal::fillFixed(G, flags, n);
+        Mat G;
+        ws.system.solve(paramIdx, epsilon, G);
+        G = alpha_smooth2 * G;
 
         finalParam = currentParam + G.t();
 
@@ -1149,6 +1997,18 @@ double cv::omnidir::calibrate(InputArrayOfArrays patternPoints, InputArrayOfArra
         cv::omnidir::internal::decodeParameters(currentParam, _K, _omAll, _tAll, _D, _xi);
         //double repr = internal::computeMeanReproErr(_patternPoints, _imagePoints, _K, _D, _xi, _omAll, _tAll);
     }
+    if (solver == SOLVER_LEVENBERG_MARQUARDT)
+    {
+        optimizeLevenbergMarquardt(ws, paramIdx, criteria, currentParam, _report);
+        finalParam = currentParam.clone();
+    }
+    else if (report)
+    {
+        _report.costHistory.push_back(computeCost(ws, currentParam));
+        _report.costEvaluations++;
+    }
+    if (report)
+        *report = _report;
     cv::omnidir::internal::decodeParameters(currentParam, _K, _omAll, _tAll, _D, _xi);
 
     //double repr = internal::computeMeanReproErr(_patternPoints, _imagePoints, _K, _D, _xi, _omAll, _tAll);
@@ -1210,7 +2070,9 @@ double cv::omnidir::calibrate(InputArrayOfArrays patternPoints, InputArrayOfArra
     Vec2d std_error;
     double rms;
     Mat errors;
-    cv::omnidir::internal::estimateUncertainties(_patternPoints, _imagePoints, finalParam, errors, std_error, rms, flags);
+    estimateIntrinsicUncertainties(ws, finalParam, paramIdx, errors, std_error, rms);
+    if (report)
+        report->intrinsicErrors = errors.reshape(1, 1).clone();
     return rms;
 }
 
@@ -1272,6 +2134,11 @@ double cv::omnidir::stereoCalibrate(InputOutputArrayOfArrays objectPoints, Input
     //    _T, _omL, _TL);
     cv::omnidir::internal::encodeParametersStereo(_K1, _K2, _om, _T, _omL, _TL, _D1, _D2, _xi1, _xi2, currentParam);
 
+    std::vector<int> paramIdx(6*(n+1)+20, 1);
+    cv::omnidir::internal::flags2idxStereo(flags, paramIdx, n);
+    NormalEquationsWorkspace ws;
+    ws.create(_objectPointsFilt, _imagePoints1Filt, _imagePoints2Filt);
+
     // optimization
     const double alpha_smooth = 0.01;
     double change = 1;
@@ -1282,16 +2149,13 @@ double cv::omnidir::stereoCalibrate(InputOutputArrayOfArrays objectPoints, Input
             (criteria.type == 3 && (change <= criteria.epsilon || iter >= criteria.maxCount)))
             break;
         double alpha_smooth2 = 1 - std::pow(1 - alpha_smooth, (double)iter + 1.0);
-        Mat JTJ_inv, JTError;
 		double epsilon = 0.01 * std::pow(0.9, (double)iter/10);
-
-        cv::omnidir::internal::computeJacobianStereo(_objectPointsFilt, _imagePoints1Filt, _imagePoints2Filt, currentParam,
-			JTJ_inv, JTError, flags, epsilon);
+        computeNormalEquationsStereo(ws, currentParam);
 
         // Gauss - Newton
-        Mat G = alpha_smooth2*JTJ_inv * JTError;
-
-        omnidir::internal::fillFixedStereo(G, flags, n);
+        Mat G;
+        ws.system.solve(paramIdx, epsilon, G);
+        G = alpha_smooth2 * G;
 
         finalParam = currentParam + G.t();
 
@@ -1760,26 +2624,20 @@ void cv::omnidir::internal::estimateUncertainties(InputArrayOfArrays objectPoint
     double xi = para[6*n+5];
     int nPointsAccu = 0;
 
+    // the residuals of view i are written in place into its rows of reprojError
+    std::vector<Mat> objPoints(n), imgPoints(n), errorx(n);
+    std::vector<Vec3d> omAll(n), tAll(n);
     for(int i=0; i < n; ++i)
     {
-		Mat imgPoints, objPoints;
-		imagePoints.getMat(i).copyTo(imgPoints);
-		objectPoints.getMat(i).copyTo(objPoints);
-		imgPoints = imgPoints.reshape(2, imgPoints.rows*imgPoints.cols);
-		objPoints = objPoints.reshape(3, objPoints.rows*objPoints.cols);
-
-        Mat om = parameters.getMat().colRange(i*6, i*6+3);
-        Mat T = parameters.getMat().colRange(i*6+3, (i+1)*6);
-
-        Mat x;
-        omnidir::projectPoints(objPoints, x, om, T, K, xi, D, cv::noArray());
-
-        Mat errorx = (imgPoints - x);
-
-        //reprojError.rowRange(errorx.rows*i, errorx.rows*(i+1)) = errorx.clone();
-        errorx.copyTo(reprojError.rowRange(nPointsAccu, nPointsAccu + (int)errorx.total()));
-        nPointsAccu += (int)errorx.total();
+        Mat obj = objectPoints.getMat(i), img = imagePoints.getMat(i);
+        objPoints[i] = obj.isContinuous() ? obj.reshape(3, (int)obj.total()) : obj.clone().reshape(3, (int)obj.total());
+        imgPoints[i] = img.isContinuous() ? img.reshape(2, (int)img.total()) : img.clone().reshape(2, (int)img.total());
+        omAll[i] = Vec3d(para + i*6);
+        tAll[i] = Vec3d(para + i*6 + 3);
+        errorx[i] = reprojError.rowRange(nPointsAccu, nPointsAccu + (int)objPoints[i].total());
+        nPointsAccu += (int)objPoints[i].total();
     }
+    parallel_for_(Range(0, n), ProjectViewsBody(objPoints, omAll, tAll, K, D, xi, errorx, &imgPoints));
 
     meanStdDev(reprojError, noArray(), std_error);
     std_error *= sqrt((double)reprojError.total()/((double)reprojError.total() - 1.0));
@@ -1943,17 +2801,23 @@ double cv::omnidir::internal::computeMeanReproErr(InputArrayOfArrays objectPoint
     CV_Assert(objectPoints.total() == imagePoints.total());
     CV_Assert(!objectPoints.empty() && objectPoints.type() == CV_64FC3);
     CV_Assert(!imagePoints.empty() && imagePoints.type() == CV_64FC2);
-    std::vector<Mat> proImagePoints;
     int n = (int)objectPoints.total();
-    Mat _omAll = omAll.getMat();
-    Mat _tAll = tAll.getMat();
+    std::vector<Mat> proImagePoints(n), _objectPoints(n);
+    std::vector<Vec3d> _omAll(n), _tAll(n);
+    Mat omAll_m = omAll.getMat();
+    Mat tAll_m = tAll.getMat();
     for(int i = 0; i < n; ++i)
     {
-        Mat imgPoint;
-        //cv::omnidir::projectPoints(objetPoints.getMat(i), imgPoint, omAll.getMat(i), tAll.getMat(i), K.getMat(), xi, D.getMat(), noArray());
-        cv::omnidir::projectPoints(objectPoints.getMat(i), imgPoint, _omAll.at<Vec3d>(i), _tAll.at<Vec3d>(i), K.getMat(), xi, D.getMat(), noArray());
-        proImagePoints.push_back(imgPoint);
+        _objectPoints[i] = objectPoints.getMat(i);
+        _omAll[i] = omAll_m.at<Vec3d>(i);
+        _tAll[i] = tAll_m.at<Vec3d>(i);
     }
+    Matx33d _K;
+    Matx14d _D;
+    K.getMat().convertTo(_K, CV_64F);
+    D.getMat().reshape(1, 1).convertTo(_D, CV_64F);
+    // the views are projected in parallel, the errors summed in view order
+    parallel_for_(Range(0, n), ProjectViewsBody(_objectPoints, _omAll, _tAll, _K, _D, xi, proImagePoints));
 
     return internal::computeMeanReproErr(imagePoints, proImagePoints);
 }
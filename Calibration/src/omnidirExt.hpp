@@ -0,0 +1,85 @@
+/*
+ * omnidirExt.hpp
+ *
+ * Additions to the cv::omnidir module of opencv_contrib, implemented in the
+ * local copy omnidir.cpp.
+ */
+
+#ifndef SRC_OMNIDIREXT_HPP_
+#define SRC_OMNIDIREXT_HPP_
+
+#include "opencv2/ccalib/omnidir.hpp"
+#include <vector>
+
+namespace cv
+{
+namespace omnidir
+{
+    enum {
+        SOLVER_SCHEDULED_GN = 0,        //!< damped Gauss-Newton with the fixed epsilon/alpha schedule of calibrate
+        SOLVER_LEVENBERG_MARQUARDT = 1  //!< Levenberg-Marquardt with gain ratio based damping
+    };
+
+    /** @brief Convergence report of calibrate.
+
+    The cost is the sum of the squared reprojection errors of the views retained by the initialization.
+    */
+    struct CalibrateReport
+    {
+        int iterations;                  //!< iterations of the optimization loop
+        int jacobianEvaluations;         //!< evaluations of the normal equations
+        int costEvaluations;             //!< cost evaluations of candidate steps, accepted or not
+        int rejectedSteps;               //!< LM steps that did not decrease the cost
+        std::vector<double> costHistory; //!< cost before the first iteration and after every accepted step
+        Mat intrinsicErrors;             //!< 3 sigma of fx, fy, s, cx, cy, xi, k1, k2, p1, p2, zero when fixed
+
+        CalibrateReport() : iterations(0), jacobianEvaluations(0), costEvaluations(0), rejectedSteps(0) {}
+    };
+
+    /** @brief Perform omnidirectional camera calibration with a choice of solver.
+
+    Same as calibrate above. With CALIB_USE_GUESS, K, D and xi are the starting point and initializeCalibration is skipped. rvecs and
+    tvecs may hold the poses of the first views; the other views are initialized by estimatePatternPose.
+    @param solver SOLVER_SCHEDULED_GN (the behaviour of calibrate) or SOLVER_LEVENBERG_MARQUARDT. With LM,
+    criteria.epsilon bounds the relative decrease of the cost and the relative step size.
+    @param report If not null, filled with the iteration count and the cost history.
+    */
+    CV_EXPORTS double calibrate(InputArrayOfArrays objectPoints, InputArrayOfArrays imagePoints, Size size,
+        InputOutputArray K, InputOutputArray xi, InputOutputArray D, OutputArrayOfArrays rvecs, OutputArrayOfArrays tvecs,
+        int flags, TermCriteria criteria, OutputArray idx, int solver, CalibrateReport* report);
+
+    /** @brief Projection of large point sets, without Jacobian.
+
+    Same model as projectPoints, evaluated in blocks of points by the threads and in SIMD lanes. CV_32FC3
+    points are projected in single precision, CV_64FC3 points in double precision; the results match
+    projectPoints up to rounding.
+    */
+    CV_EXPORTS void projectPointsBatch(InputArray objectPoints, OutputArray imagePoints, InputArray rvec, InputArray tvec,
+        InputArray K, double xi, InputArray D);
+
+    /** @brief Unit bearing vectors of image points, the inverse of projectPoints.
+
+    Each point is undistorted as in undistortPoints, then lifted to the unit sphere of the Mei model.
+    @param imagePoints Image points, CV_64FC2 or CV_32FC2.
+    @param bearings Unit vectors in the camera frame, CV_64FC3 or CV_32FC3 as the input, same size.
+    */
+    CV_EXPORTS void imagePointsToBearings(InputArray imagePoints, OutputArray bearings, InputArray K, InputArray D,
+        double xi);
+
+    /** @brief Pose of a planar pattern view for known intrinsics.
+
+    The image points are lifted to unit bearing vectors with K, D and xi, the pattern to bearing
+    homography is estimated by DLT and decomposed into a pose, which is refined by a few Gauss-Newton
+    steps on the reprojection error. Used to initialize new views when calibrate is called with
+    CALIB_USE_GUESS.
+    @param patternPoints Points of the pattern, CV_64FC3 with z = 0.
+    @param imagePoints Detected points, CV_64FC2.
+    @param iterations Gauss-Newton steps.
+    @return Mean reprojection error of the pose, in pixels.
+    */
+    CV_EXPORTS double estimatePatternPose(InputArray patternPoints, InputArray imagePoints, InputArray K, InputArray D,
+        double xi, OutputArray om, OutputArray T, int iterations = 5);
+}
+}
+
+#endif /* SRC_OMNIDIREXT_HPP_ */
@@ -10,6 +10,8 @@
 
 #include "cmosCalibration.hpp"
 #include "imageSource.hpp"
+#include "mirrorTracker.hpp"
+#include "frameContext.hpp"
 
 using namespace cv;
 using namespace std;
@@ -21,24 +23,30 @@ int max_thresh = 255;
 RNG rng(12345);
 
 /// Function header
-void processFrame(CmosParam s);
+void processFrame(const CmosParam &s, FrameContext &context);
+void processFrameFast(const CmosParam &s, FrameContext &context, bool refine);
 
 static const char USAGE[] =
 		R"(positionCalibration.
 
     Usage:
-      positionCalibration vc <cameraId> <calib.xml> 
-      positionCalibration v4l <cameraId> <calib.xml> 
+      positionCalibration vc <cameraId> <calib.xml> [--fast [--refine]]
+      positionCalibration v4l <cameraId> <calib.xml> [--fast [--refine]]
+      positionCalibration replay <pattern> <calib.xml> [--fast [--refine]]
+      positionCalibration synthetic <calib.xml> [--fast [--refine]]
       positionCalibration (-h | --help)
 
     Options:
       -h --help     Show this screen.
+      --fast        Find the mirror edge on the sensor image and fit the circle algebraically, at the camera rate.
+      --refine      With --fast, refine the circle by Gauss-Newton from the one of the previous frame.
 )";
 
 int main(int argc, char** argv) {
 	std::map<std::string, docopt::value> args = docopt::docopt(USAGE,
 			{ argv + 1, argv + argc }, true,           // show help if requested
 			"0.1");  // version string
+	AllocationReport allocations;
 
 	//Read calibration settings
 	CmosParam s(args["<calib.xml>"].asString());
@@ -48,10 +56,24 @@ int main(int argc, char** argv) {
 		imageSource = new VcImageSource(args["<cameraId>"].asLong());
 	}
 
+	bool fast = args["--fast"].asBool();
 	if (args["v4l"].asBool()) {
+		// the fast mode reads the grey frames in place
 		imageSource = new V4lImageSource(args["<cameraId>"].asLong(),
-				CvSize(s.imageSize));
+				CvSize(s.imageSize), !fast);
 	}
+	// recorded frames, or a mirror of known centre and radius
+	if (args["replay"].asBool()) {
+		imageSource = new ReplayImageSource(args["<pattern>"].asString());
+	}
+
+	if (args["synthetic"].asBool()) {
+		imageSource = new SyntheticImageSource(s.imageSize, SyntheticImageSource::MIRROR);
+	}
+
+	// the frame processing no longer holds the capture back; 2 slots leave
+	// driver buffers free when the frames are not copied
+	imageSource = new AsyncImageSource(imageSource, AsyncImageSource::LATEST, fast ? 2 : 4);
 
 	namedWindow("stream", WINDOW_NORMAL);
 	resizeWindow("stream", s.imageSize.width / 2, s.imageSize.height / 2);
@@ -59,18 +81,35 @@ int main(int argc, char** argv) {
 //	src = imread( "img/mirrorB_rgb.bmp", 1 );
 
 	//Stream cam
-	for (;;) {
-		Mat frame, frameUpscaled/*,frameRectified*/;
-		imageSource->next(frame);
-		resize(frame, frameUpscaled, s.imageSize); //resize image
-		s.rectifyImage(frameUpscaled, src);
-		cvtColor(src, src_gray, cv::COLOR_RGB2GRAY);
-		//imshow("this is you, smile! :)", frameRectified);
-		processFrame(s);
-		if (waitKey(10) == 27)
-			break; // stop capturing by pressing ESC
+	FrameContext context;
+	if (fast) {
+		bool refine = args["--refine"].asBool();
+		context.reserve(s.imageSize, CV_8UC1);
+		for (;;) {
+			context.next(*imageSource);
+			processFrameFast(s, context, refine);
+			allocations.frame();
+			if (waitKey(1) == 27)
+				break; // stop capturing by pressing ESC
+		}
+	} else {
+		context.reserve(s.imageSize, CV_8UC3, s.imageSize);
+		for (;;) {
+			context.next(*imageSource);
+			s.rectifyImage(context.frame, src); // resized to imageSize by the maps
+			cvtColor(src, src_gray, cv::COLOR_RGB2GRAY);
+			//imshow("this is you, smile! :)", frameRectified);
+			processFrame(s, context);
+			allocations.frame();
+			if (waitKey(10) == 27)
+				break; // stop capturing by pressing ESC
+		}
 	}
+	allocations.print(cout);
 
+	// the last frame may be a driver buffer of the source, given back first
+	context.frame.release();
+	delete imageSource;
 	return 0;
 }
 
@@ -104,21 +143,16 @@ public:
 	}
 };
 
-void processFrame(CmosParam s) {
-	Mat threshold_output;
-	vector<Vec4i> hierarchy;
-
-	/// Detect edges using Threshold
-	threshold(src_gray, threshold_output, thresh, 255, THRESH_BINARY);
-
-	/// Draw contours + rotated rects + ellipses
-	Mat drawing = Mat::zeros(threshold_output.size(), CV_8UC3);
+void processFrame(const CmosParam &s, FrameContext &context) {
+	/// Draw the edge points and the circle on the rectified frame
+	Mat &drawing = context.shown;
 	src.copyTo(drawing);
 
 	Point center(s.cameraMatrix.at<double>(0,2), s.cameraMatrix.at<double>(1,2));
 
 	int degreeStart = -65, degreeEnd = 180 + 65;
-	std::vector<cv::Point2i> pointPositions;
+	std::vector<cv::Point2i> &pointPositions = context.pointPositions;
+	pointPositions.clear();
 
 	//Get mirror borders points
 	for (int degree = degreeStart; degree < degreeEnd; degree += 2) {
@@ -204,3 +238,57 @@ void processFrame(CmosParam s) {
 	imshow("stream", drawing);
 }
 
+// The mirror edge is found on the sensor frame along the rays of processFrame,
+// only the edge points are rectified, and the circle is fitted to them by the
+// algebraic fit of Taubin instead of the downhill simplex on the L1 cost.
+void processFrameFast(const CmosParam &s, FrameContext &context, bool refine) {
+	static MirrorTracker *tracker = NULL;
+	static Vec3d previous;
+	static bool tracking = false;
+	static int64 last = getTickCount();
+
+	const Mat &gray = context.toGray();
+	// principal point on the frame, which may be smaller than the calibration images
+	Point2d scale((double) gray.cols / s.imageSize.width, (double) gray.rows / s.imageSize.height);
+	Point2d center(s.cameraMatrix.at<double>(0, 2), s.cameraMatrix.at<double>(1, 2));
+	if (tracker == NULL)
+		tracker = new MirrorTracker(Point2d(center.x * scale.x, center.y * scale.y), center.y * scale.y - 5, thresh);
+
+	vector<Point2d> &edges = context.edges, &scaled = context.scaled, &points = context.points;
+	tracker->findEdges(gray, edges, context.found);
+	scaled.clear();
+	for (size_t i = 0; i < edges.size(); i++)
+		scaled.push_back(Point2d(edges[i].x / scale.x, edges[i].y / scale.y));
+	s.rectifyPoints(scaled, points);
+
+	Vec3d circle;
+	if (!MirrorTracker::fitRobust(points, circle)) {
+		tracking = false;
+		cout << "Mirror edge not found" << endl;
+	} else {
+		double error = MirrorTracker::rms(points, circle);
+		if (refine) {
+			Vec3d refined = tracking ? previous : circle;
+			double refinedError = MirrorTracker::refine(points, refined);
+			if (refinedError <= error) {
+				circle = refined;
+				error = refinedError;
+			}
+		}
+		previous = circle;
+		tracking = true;
+		int64 now = getTickCount();
+		double fps = getTickFrequency() / std::max<int64>(now - last, 1);
+		last = now;
+		cout << circle << " rms " << error << " on " << points.size() << " points, Error optic center XY = "
+				<< circle[0] - center.x << "  " << circle[1] - center.y << ", " << fps << " fps" << endl;
+	}
+
+	// the sensor frame at a quarter of its size, with the edge points
+	Mat &small = context.small, &drawing = context.shown;
+	resize(gray, small, Size(), 0.25, 0.25, INTER_NEAREST);
+	cvtColor(small, drawing, cv::COLOR_GRAY2BGR);
+	for (size_t i = 0; i < edges.size(); i++)
+		drawMarker(drawing, edges[i] * 0.25, cv::Scalar(0, 255, 0), MARKER_CROSS, 5, 1);
+	imshow("stream", drawing);
+}
@@ -0,0 +1,107 @@
+/*
+ * projectBenchmark.cpp
+ *
+ * Compares omnidir::projectPointsBatch with omnidir::projectPoints on a large
+ * random point cloud, in time and in result.
+ */
+
+#include "omnidir.cpp"
+#include "opencv2/ccalib/omnidir.hpp"
+#include "opencv2/core.hpp"
+#include <vector>
+#include <iostream>
+#include <string>
+#include <chrono>
+
+using namespace cv;
+using namespace std;
+using namespace std::chrono;
+
+static void help() {
+	printf(
+			"\n Benchmark of the batch projection of omnidir.\n"
+					"Usage: projectBenchmark\n"
+					"    [-n <points>] # number of points of the cloud (10000000 by default)\n"
+					"    [-r <runs>] # runs of each projection, the best time is kept (3 by default)\n"
+					"    [calibration] # out_camera_omni.xml written by omniCalibration, a typical model by default\n");
+}
+
+// Best time of `runs` calls, in milliseconds
+template<typename F>
+static double bestTime(int runs, F f) {
+	double best = 0;
+	for (int r = 0; r < runs; r++) {
+		high_resolution_clock::time_point t1 = high_resolution_clock::now();
+		f();
+		high_resolution_clock::time_point t2 = high_resolution_clock::now();
+		double ms = duration_cast<microseconds>(t2 - t1).count() / 1000.0;
+		if (r == 0 || ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+int main(int argc, char** argv) {
+	int n = 10000000, runs = 3;
+	const char* calibrationFilename = 0;
+	for (int i = 1; i < argc; i++) {
+		const char* s = argv[i];
+		if (strcmp(s, "-n") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &n) != 1 || n <= 0)
+				return fprintf(stderr, "Invalid number of points\n"), -1;
+		} else if (strcmp(s, "-r") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &runs) != 1 || runs <= 0)
+				return fprintf(stderr, "Invalid number of runs\n"), -1;
+		} else if (strcmp(s, "-h") == 0) {
+			help();
+			return 0;
+		} else if (s[0] != '-') {
+			calibrationFilename = s;
+		} else {
+			return fprintf(stderr, "Unknown option %s\n", s), -1;
+		}
+	}
+
+	Mat K = (Mat_<double>(3, 3) << 700, 0.5, 1024, 0, 700, 1024, 0, 0, 1);
+	Mat D = (Mat_<double>(1, 4) << -0.2, 0.05, 1e-4, -1e-4);
+	double xi = 1.2;
+	if (calibrationFilename) {
+		FileStorage fs(calibrationFilename, FileStorage::READ);
+		if (!fs.isOpened())
+			return fprintf(stderr, "Failed to open %s\n", calibrationFilename), -1;
+		fs["camera_matrix"] >> K;
+		fs["distortion_coefficients"] >> D;
+		fs["xi"] >> xi;
+	}
+	Vec3d om(0.1, -0.2, 0.3), T(0.5, -0.25, 1);
+
+	// points all around the camera, between 1 and 20 units away
+	Mat cloudd(n, 1, CV_64FC3), cloudf;
+	RNG rng(0x5ca1ab1e);
+	for (int i = 0; i < n; i++) {
+		Vec3d d(rng.gaussian(1), rng.gaussian(1), rng.gaussian(1));
+		cloudd.at<Vec3d>(i) = d * (rng.uniform(1., 20.) / norm(d)) - T;
+	}
+	cloudd.convertTo(cloudf, CV_32F);
+	cout << n << " points, " << getNumThreads() << " threads" << endl;
+
+	for (int depth = 0; depth < 2; depth++) {
+		const Mat& cloud = depth == 0 ? cloudd : cloudf;
+		Mat reference, batch;
+		double tRef = bestTime(runs, [&] {
+			omnidir::projectPoints(cloud, reference, om, T, K, xi, D, noArray());
+		});
+		double tBatch = bestTime(runs, [&] {
+			omnidir::projectPointsBatch(cloud, batch, om, T, K, xi, D);
+		});
+		// relative difference, the points far in the field of view project far from the center
+		Mat r, b;
+		reference.convertTo(r, CV_64F);
+		batch.convertTo(b, CV_64F);
+		double maxDiff = norm(r, b, NORM_INF), maxRel = maxDiff / std::max(norm(r, NORM_INF), 1.);
+		cout << (depth == 0 ? "double" : "float ") << ": projectPoints " << tRef << " ms, projectPointsBatch "
+				<< tBatch << " ms (x" << tRef / tBatch << "), max difference " << maxDiff << " pixels ("
+				<< maxRel << " relative)" << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * snapshotWriter.hpp
+ *
+ * Writes the snapshots of camCapture on a thread of its own, so that saving
+ * an image does not pause the acquisition nor the preview.
+ */
+
+#ifndef SRC_SNAPSHOTWRITER_HPP_
+#define SRC_SNAPSHOTWRITER_HPP_
+
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <atomic>
+
+#include "boundedQueue.hpp"
+
+using namespace cv;
+using namespace std;
+
+// The snapshots are converted to grey and written in the order they are queued.
+// The queue is bounded: when the writer falls behind, e.g. during a burst,
+// push() drops the snapshot instead of blocking the capture, and reports it.
+// RAW is the bare 8 bit pixels row after row, like the .raw frames of
+// Grab_UsingActionCommand, and is the cheapest to write.
+class SnapshotWriter {
+public:
+	enum Format {
+		BMP, PNG, TIFF, RAW
+	};
+
+	SnapshotWriter(Format format = BMP, int pngCompression = 3, size_t capacity = 64) :
+			format(format), pngCompression(pngCompression), queue(capacity), pendingCount(0), writtenCount(0),
+			droppedCount(0), failedCount(0) {
+		worker = std::thread(&SnapshotWriter::run, this);
+	}
+
+	// Writes what is left in the queue
+	~SnapshotWriter() {
+		queue.close();
+		worker.join();
+	}
+
+	// bmp, png, tiff or raw, false if unknown
+	static bool parseFormat(const string &name, Format &format) {
+		static const char* names[] = { "bmp", "png", "tiff", "raw" };
+		for (int i = 0; i < 4; i++) {
+			if (name == names[i]) {
+				format = (Format) i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Queues the image under name, the extension is added; the image is shared, not copied
+	bool push(const string &name, const Mat &image) {
+		Snapshot snapshot;
+		snapshot.name = name + extension();
+		snapshot.image = image;
+		pendingCount++;
+		if (!queue.tryPush(snapshot)) {
+			pendingCount--;
+			droppedCount++;
+			cerr << "Snapshot queue full, " << snapshot.name << " dropped" << endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Snapshots queued or being written
+	int pending() const {
+		return pendingCount.load();
+	}
+
+	int written() const {
+		return writtenCount.load();
+	}
+
+	int dropped() const {
+		return droppedCount.load();
+	}
+
+	int failed() const {
+		return failedCount.load();
+	}
+
+private:
+	struct Snapshot {
+		string name;
+		Mat image;
+	};
+
+	string extension() const {
+		static const char* extensions[] = { ".bmp", ".png", ".tiff", ".raw" };
+		return extensions[format];
+	}
+
+	void run() {
+		Snapshot snapshot;
+		while (queue.pop(snapshot)) {
+			Mat gray;
+			if (snapshot.image.channels() == 3)
+				cvtColor(snapshot.image, gray, COLOR_RGB2GRAY);
+			else
+				gray = snapshot.image;
+			snapshot.image.release();
+
+			bool ok;
+			if (format == RAW) {
+				ofstream file(snapshot.name.c_str(), ios::out | ios::binary);
+				for (int y = 0; y < gray.rows && file; y++)
+					file.write((const char*) gray.ptr(y), gray.cols * gray.elemSize());
+				ok = (bool) file;
+			} else {
+				vector<int> params;
+				if (format == PNG) {
+					params.push_back(IMWRITE_PNG_COMPRESSION);
+					params.push_back(pngCompression);
+				}
+				ok = imwrite(snapshot.name, gray, params);
+			}
+			int left = --pendingCount;
+			if (ok) {
+				writtenCount++;
+				cout << snapshot.name << " written, " << left << " waiting" << endl;
+			} else {
+				failedCount++;
+				cerr << "Failed to write " << snapshot.name << endl;
+			}
+		}
+	}
+
+	const Format format;
+	const int pngCompression;
+	BoundedQueue<Snapshot> queue;
+	std::atomic<int> pendingCount, writtenCount, droppedCount, failedCount;
+	std::thread worker;
+};
+
+#endif /* SRC_SNAPSHOTWRITER_HPP_ */
@@ -0,0 +1,298 @@
+#ifndef SRC_TILEDREMAP_HPP_
+#define SRC_TILEDREMAP_HPP_
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <stdint.h>
+
+using namespace cv;
+using namespace std;
+
+// Remap engine for a fixed map set (typically the equirectangular maps of
+// omniCalibration). The longitude/latitude maps walk the mirror image along
+// circles, so a row-order traversal of the output reads the source all over
+// the image. Here the output is cut into tiles, the source window each tile
+// reads is computed once, and the tiles are processed in the order of their
+// source window so that neighbouring tiles (and threads) share cache lines.
+//
+// With BORDER_CONSTANT the output pixels whose source falls outside of the
+// image, or outside of the mirror circle when one is given, are known to be
+// constant. They are stored as run-length spans of valid pixels per output
+// row, only the valid spans are interpolated and the rest is filled.
+class TiledRemap {
+public:
+	struct Tile {
+		Rect dst;       // area of the output image
+		Rect active;    // bounding box of the valid pixels of the tile, empty if none
+		bool full;      // every pixel of the tile is valid
+		Rect src;       // source window read by the tile, clipped to the source image
+		Mat map1, map2; // maps of the active area, relative to the source window
+		uint64_t order; // Z-order of the source window, used to sort the tiles
+	};
+
+	TiledRemap() : interpolation(INTER_CUBIC), borderMode(BORDER_CONSTANT), nValid(0) {}
+
+	// map1/map2 as produced by initUndistortRectifyMap: CV_16SC2 (+ CV_16UC1 or
+	// empty), or a CV_32FC1 pair. srcSize is the size of the images to remap.
+	// mirror is the circle (center x, center y, radius) of the mirror in the
+	// source image; a radius <= 0 keeps the whole image.
+	TiledRemap(const Mat &map1, const Mat &map2, Size srcSize,
+			int interpolation = INTER_CUBIC, int borderMode = BORDER_CONSTANT,
+			Vec3f mirror = Vec3f(), Size tileSize = Size(64, 32)) :
+			interpolation(interpolation), borderMode(borderMode), nValid(0) {
+		build(map1, map2, srcSize, mirror, tileSize);
+	}
+
+	void build(const Mat &map1, const Mat &map2, Size srcSize,
+			Vec3f mirror = Vec3f(), Size tileSize = Size(64, 32)) {
+		CV_Assert((map1.type() == CV_16SC2 && (map2.empty() || map2.type() == CV_16UC1))
+				|| (map1.type() == CV_32FC1 && map2.type() == CV_32FC1));
+		CV_Assert(map2.empty() || map2.size() == map1.size());
+		// Only border modes that never look at pixels outside the image can be
+		// evaluated on a clipped source window.
+		CV_Assert(borderMode == BORDER_CONSTANT || borderMode == BORDER_REPLICATE
+				|| borderMode == BORDER_TRANSPARENT);
+
+		this->srcSize = srcSize;
+		dstSize = map1.size();
+		tiles.clear();
+
+		// Taps read around the integer source position by the interpolation
+		int lo = 0, hi = 0;
+		if (interpolation == INTER_LINEAR)
+			hi = 1;
+		else if (interpolation == INTER_CUBIC)
+			lo = 1, hi = 2;
+		else if (interpolation == INTER_LANCZOS4)
+			lo = 3, hi = 4;
+		if (map1.type() == CV_32FC1)
+			lo++, hi++; // float maps are rounded to the interpolation table by remap
+
+		// Integer source position and validity of every output pixel
+		Mat srcPos(dstSize, CV_32SC2);
+		Mat valid(dstSize, CV_8U);
+		bool masked = borderMode == BORDER_CONSTANT;
+		float r2 = mirror[2] * mirror[2];
+		for (int i = 0; i < dstSize.height; i++) {
+			Vec2i *p = srcPos.ptr<Vec2i>(i);
+			uchar *v = valid.ptr<uchar>(i);
+			for (int j = 0; j < dstSize.width; j++) {
+				float fx, fy;
+				if (map1.type() == CV_16SC2) {
+					const short *m = map1.ptr<short>(i) + 2 * j;
+					int frac = map2.empty() ? 0 : map2.at<ushort>(i, j);
+					p[j] = Vec2i(m[0], m[1]);
+					fx = m[0] + (frac & (INTER_TAB_SIZE - 1)) / (float) INTER_TAB_SIZE;
+					fy = m[1] + (frac >> INTER_BITS) / (float) INTER_TAB_SIZE;
+				} else {
+					fx = map1.at<float>(i, j);
+					fy = map2.at<float>(i, j);
+					p[j] = Vec2i(cvFloor(fx), cvFloor(fy));
+				}
+				bool ok = true;
+				if (masked) {
+					ok = p[j][0] + hi >= 0 && p[j][0] - lo < srcSize.width
+							&& p[j][1] + hi >= 0 && p[j][1] - lo < srcSize.height;
+					if (ok && mirror[2] > 0) {
+						float dx = fx - mirror[0], dy = fy - mirror[1];
+						ok = dx * dx + dy * dy <= r2;
+					}
+				}
+				v[j] = ok;
+			}
+		}
+
+		// Run-length spans of the valid pixels
+		spans.clear();
+		spanRows.assign(dstSize.height + 1, 0);
+		nValid = 0;
+		for (int i = 0; i < dstSize.height; i++) {
+			const uchar *v = valid.ptr<uchar>(i);
+			spanRows[i] = (int) spans.size();
+			for (int j = 0; j < dstSize.width;) {
+				if (!v[j]) {
+					j++;
+					continue;
+				}
+				int start = j;
+				while (j < dstSize.width && v[j])
+					j++;
+				spans.push_back(Vec2i(start, j));
+				nValid += j - start;
+			}
+		}
+		spanRows[dstSize.height] = (int) spans.size();
+
+		for (int y = 0; y < dstSize.height; y += tileSize.height) {
+			for (int x = 0; x < dstSize.width; x += tileSize.width) {
+				Tile t;
+				t.dst = Rect(x, y, tileSize.width, tileSize.height) & Rect(Point(), dstSize);
+
+				int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+				int ax0 = INT_MAX, ay0 = INT_MAX, ax1 = INT_MIN, ay1 = INT_MIN;
+				int count = 0;
+				for (int i = t.dst.y; i < t.dst.y + t.dst.height; i++) {
+					const Vec2i *p = srcPos.ptr<Vec2i>(i);
+					for (int s = spanRows[i]; s < spanRows[i + 1]; s++) {
+						int j0 = std::max(spans[s][0], t.dst.x);
+						int j1 = std::min(spans[s][1], t.dst.x + t.dst.width);
+						if (j0 >= j1)
+							continue;
+						count += j1 - j0;
+						ax0 = std::min(ax0, j0);
+						ax1 = std::max(ax1, j1);
+						ay0 = std::min(ay0, i);
+						ay1 = std::max(ay1, i + 1);
+						for (int j = j0; j < j1; j++) {
+							minX = std::min(minX, p[j][0]);
+							maxX = std::max(maxX, p[j][0]);
+							minY = std::min(minY, p[j][1]);
+							maxY = std::max(maxY, p[j][1]);
+						}
+					}
+				}
+
+				if (count > 0) {
+					t.full = count == t.dst.area();
+					t.active = Rect(Point(ax0, ay0), Point(ax1, ay1));
+					// Clamping the taps to the image keeps BORDER_REPLICATE exact
+					// on the window; for BORDER_CONSTANT it is the intersection.
+					t.src = Rect(Point(clamp(minX - lo, srcSize.width), clamp(minY - lo, srcSize.height)),
+							Point(clamp(maxX + hi, srcSize.width) + 1, clamp(maxY + hi, srcSize.height) + 1));
+
+					// Move the maps into the source window
+					if (map1.type() == CV_16SC2) {
+						subtract(map1(t.active), Scalar(t.src.x, t.src.y), t.map1);
+						if (!map2.empty())
+							map2(t.active).copyTo(t.map2);
+					} else {
+						subtract(map1(t.active), Scalar(t.src.x), t.map1);
+						subtract(map2(t.active), Scalar(t.src.y), t.map2);
+					}
+					t.order = zOrder((t.src.x + t.src.width / 2) >> 5, (t.src.y + t.src.height / 2) >> 5);
+				} else {
+					// Nothing to interpolate in this tile
+					t.full = false;
+					t.order = 0;
+				}
+				tiles.push_back(t);
+			}
+		}
+
+		std::stable_sort(tiles.begin(), tiles.end(),
+				[](const Tile &a, const Tile &b) { return a.order < b.order; });
+	}
+
+	void remap(const Mat &src, Mat &dst, const Scalar &borderValue = Scalar()) const {
+		CV_Assert(src.size() == srcSize && !tiles.empty());
+		dst.create(dstSize, src.type());
+		parallel_for_(Range(0, (int) tiles.size()),
+				RemapBody(*this, src, dst, borderValue),
+				(double) tiles.size() / 16);
+	}
+
+	// CV_8UC1 mask of the output pixels that are interpolated, 255 on the spans
+	void validMask(Mat &mask) const {
+		mask.create(dstSize, CV_8UC1);
+		mask.setTo(Scalar::all(0));
+		for (int i = 0; i < dstSize.height; i++) {
+			uchar *m = mask.ptr<uchar>(i);
+			for (int s = spanRows[i]; s < spanRows[i + 1]; s++)
+				std::fill(m + spans[s][0], m + spans[s][1], (uchar) 255);
+		}
+	}
+
+	// Fraction of the output pixels that are interpolated
+	double validRatio() const {
+		return dstSize.area() > 0 ? (double) nValid / dstSize.area() : 0;
+	}
+
+	Size srcSize, dstSize;
+	int interpolation;
+	int borderMode;
+	vector<Tile> tiles;
+	vector<Vec2i> spans;  // [begin, end) columns of the valid runs
+	vector<int> spanRows; // spans of row i are spans[spanRows[i]] .. spans[spanRows[i + 1] - 1]
+	long nValid;
+
+private:
+	// Source windows at most this many times larger than their tile are copied
+	// into a contiguous buffer before remapping: the random reads of the
+	// interpolation then stay within a few pages instead of one page per row.
+	static const int prefetchRatio = 4;
+
+	static int clamp(int v, int size) {
+		return std::min(std::max(v, 0), size - 1);
+	}
+
+	static uint64_t zOrder(int x, int y) {
+		uint64_t code = 0;
+		for (int b = 0; b < 16; b++) {
+			code |= (uint64_t) ((x >> b) & 1) << (2 * b);
+			code |= (uint64_t) ((y >> b) & 1) << (2 * b + 1);
+		}
+		return code + 1; // 0 is reserved for the tiles without source
+	}
+
+	// Fills the pixels of the tile that are not covered by a valid span
+	void fillInvalid(Mat &dst, const Tile &t, const Scalar &borderValue) const {
+		int x1 = t.dst.x + t.dst.width;
+		for (int i = t.dst.y; i < t.dst.y + t.dst.height; i++) {
+			Mat row = dst.row(i);
+			int x = t.dst.x;
+			for (int s = spanRows[i]; s < spanRows[i + 1] && x < x1; s++) {
+				if (spans[s][1] <= x)
+					continue;
+				int end = std::min(spans[s][0], x1);
+				if (end > x)
+					row.colRange(x, end).setTo(borderValue);
+				x = spans[s][1];
+			}
+			if (x < x1)
+				row.colRange(x, x1).setTo(borderValue);
+		}
+	}
+
+	class RemapBody: public ParallelLoopBody {
+	public:
+		RemapBody(const TiledRemap &r, const Mat &src, Mat &dst, const Scalar &borderValue) :
+				r(r), src(src), dst(dst), borderValue(borderValue) {
+		}
+
+		void operator()(const Range &range) const {
+			vector<uchar> window;
+			for (int k = range.start; k < range.end; k++) {
+				const Tile &t = r.tiles[k];
+				if (t.active.area() == 0) {
+					if (r.borderMode == BORDER_CONSTANT)
+						dst(t.dst).setTo(borderValue);
+					continue;
+				}
+				Mat srcTile = src(t.src);
+				if (t.src.area() <= prefetchRatio * t.active.area()) {
+					size_t rowSize = t.src.width * src.elemSize();
+					window.resize(std::max(window.size(), rowSize * t.src.height));
+					Mat compact(t.src.height, t.src.width, src.type(), &window[0], rowSize);
+					srcTile.copyTo(compact);
+					srcTile = compact;
+				}
+				Mat dstActive = dst(t.active);
+				cv::remap(srcTile, dstActive, t.map1, t.map2, r.interpolation, r.borderMode, borderValue);
+				if (!t.full && r.borderMode == BORDER_CONSTANT)
+					r.fillInvalid(dst, t, borderValue);
+			}
+		}
+
+	private:
+		const TiledRemap &r;
+		const Mat &src;
+		Mat &dst;
+		Scalar borderValue;
+	};
+};
+
+#endif /* SRC_TILEDREMAP_HPP_ */
@@ -0,0 +1,148 @@
+/*
+ * v4lMultiCapture.cpp
+ *
+ * Captures from several V4L2 cameras in one thread and reports, per camera,
+ * the frame rate and the frames dropped by the driver, and the spread of the
+ * timestamps of the latest frames of all the cameras.
+ *
+ * Without cameras, the vivid virtual driver gives capture devices:
+ *   sudo modprobe vivid n_devs=2 node_types=0x1,0x1
+ *   bin/v4lMultiCapture /dev/video0 /dev/video1
+ */
+
+#include "v4ldevice.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+static void help() {
+	printf(
+			"\n Captures from several V4L2 cameras in one thread.\n"
+					"Usage: v4lMultiCapture\n"
+					"    [-n <frames>] # frames to capture per camera (300 by default)\n"
+					"    [-size <width> <height>] # format of the frames (1280 x 960 by default)\n"
+					"    [-t <ms>] # time without any frame before giving up (2000 by default)\n"
+					"    device... # e.g. /dev/video0 /dev/video1\n");
+}
+
+struct Stats {
+	int frames;
+	unsigned int dropped;
+	unsigned int lastSequence;
+	int64_t first, last;
+};
+
+int main(int argc, char** argv) {
+	int n = 300, width = 1280, height = 960, timeoutMs = 2000;
+	std::vector<const char*> names;
+	for (int i = 1; i < argc; i++) {
+		const char* s = argv[i];
+		if (strcmp(s, "-n") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &n) != 1 || n <= 0)
+				return fprintf(stderr, "Invalid number of frames\n"), -1;
+		} else if (strcmp(s, "-size") == 0) {
+			if (i + 2 >= argc || sscanf(argv[++i], "%d", &width) != 1 || sscanf(argv[++i], "%d", &height) != 1
+					|| width <= 0 || height <= 0)
+				return fprintf(stderr, "Invalid size\n"), -1;
+		} else if (strcmp(s, "-t") == 0) {
+			if (i + 1 >= argc || sscanf(argv[++i], "%d", &timeoutMs) != 1 || timeoutMs <= 0)
+				return fprintf(stderr, "Invalid timeout\n"), -1;
+		} else if (strcmp(s, "-h") == 0) {
+			help();
+			return 0;
+		} else if (s[0] != '-') {
+			names.push_back(s);
+		} else {
+			return fprintf(stderr, "Unknown option %s\n", s), -1;
+		}
+	}
+	if (names.empty()) {
+		help();
+		return 1;
+	}
+
+	// one device per camera, all dequeued by the loop below
+	std::vector<V4l2Device*> devices;
+	V4l2MultiCapture capture;
+	int status = 0;
+	for (size_t d = 0; d < names.size() && status == 0; d++) {
+		V4l2Device* device = new V4l2Device();
+		devices.push_back(device);
+		if (!device->open(names[d]) || !device->init(width, height) || !device->start()) {
+			fprintf(stderr, "%s\n", device->error().c_str());
+			status = -1;
+		} else if (capture.add(device) < 0) {
+			fprintf(stderr, "%s\n", capture.error().c_str());
+			status = -1;
+		} else {
+			printf("%s: %d x %d, stride %d, %u buffers\n", device->name(), device->width(), device->height(),
+					device->stride(), device->bufferCount());
+		}
+	}
+
+	std::vector<Stats> stats(devices.size());
+	memset(&stats[0], 0, stats.size() * sizeof(Stats));
+	int64_t maxSpread = 0;
+	std::vector<V4l2Frame> frames;
+	for (;;) {
+		if (status != 0)
+			break;
+		int done = 0;
+		for (size_t d = 0; d < stats.size(); d++)
+			done += stats[d].frames >= n;
+		if (done == (int) stats.size())
+			break;
+
+		frames.clear();
+		int r = capture.wait(frames, timeoutMs);
+		if (r < 0) {
+			fprintf(stderr, "%s\n", capture.error().c_str());
+			status = -1;
+		} else if (r == 0) {
+			fprintf(stderr, "No frame within %d ms\n", timeoutMs);
+			status = -1;
+		}
+		for (size_t f = 0; f < frames.size(); f++) {
+			const V4l2Frame& frame = frames[f];
+			Stats& s = stats[frame.device];
+			if (s.frames == 0)
+				s.first = frame.timestamp;
+			else if (frame.sequence > s.lastSequence + 1)
+				s.dropped += frame.sequence - s.lastSequence - 1;
+			s.lastSequence = frame.sequence;
+			s.last = frame.timestamp;
+			s.frames++;
+			if (!capture.release(frame)) {
+				fprintf(stderr, "%s\n", capture.error().c_str());
+				status = -1;
+			}
+		}
+
+		// spread of the latest timestamps, once every camera has delivered
+		int64_t lo = INT64_MAX, hi = INT64_MIN;
+		for (size_t d = 0; d < stats.size(); d++) {
+			if (stats[d].frames == 0) {
+				lo = hi = 0;
+				break;
+			}
+			lo = std::min(lo, stats[d].last);
+			hi = std::max(hi, stats[d].last);
+		}
+		maxSpread = std::max(maxSpread, hi - lo);
+	}
+
+	for (size_t d = 0; d < stats.size(); d++) {
+		const Stats& s = stats[d];
+		double seconds = (s.last - s.first) / 1e6;
+		printf("%s: %d frames, %.2f fps, %u dropped\n", devices[d]->name(), s.frames,
+				seconds > 0 ? (s.frames - 1) / seconds : 0., s.dropped);
+	}
+	if (devices.size() > 1)
+		printf("latest frames up to %.3f ms apart\n", maxSpread / 1e3);
+
+	for (size_t d = 0; d < devices.size(); d++)
+		delete devices[d];
+	return status;
+}
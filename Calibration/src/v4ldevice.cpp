@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
 
 #include <fcntl.h>              /* low-level i/o */
@@ -21,71 +22,90 @@
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 #include <linux/videodev2.h>
 
 #include <libv4l2.h>
-#include <sys/ioctl.h>
-#include <fcntl.h>
+
+#include "v4ldevice.h"
 
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
-enum io_method
+
+static int xioctl (int fh, int request, void *arg)
 {
-    IO_METHOD_READ,
-    IO_METHOD_MMAP,
-    IO_METHOD_USERPTR,
-};
+    int r;
+
+    do
+    {
+        r = ioctl(fh, request, arg);
+    } while (-1 == r && EINTR == errno);
+
+    return r;
+}
 
-struct buffer
+
+static int64_t monotonic_us (void)
 {
-    void   *start;
-    size_t  length;
-};
+    struct timespec ts;
 
-struct v4l2_buffer buf;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-char            dev_name[1024];
-enum io_method   io = IO_METHOD_MMAP;
-int              fd = -1;
-struct buffer          *buffers;
-unsigned int     n_buffers;
-int              out_buf;
-int              force_format = 1;
-int              frame_count = 10;
 
+V4l2Device::V4l2Device (IoMethod io)
+    : io(io), fd_(-1), nBuffers(0), streaming_(false),
+      frameWidth(0), frameHeight(0), frameStride(0), snapIndex(-1)
+{
+}
 
-void errno_exit (const char *s)
+V4l2Device::~V4l2Device ()
 {
-    fprintf(stderr, "%s error %d, %s\n", s, errno, strerror(errno));
-    exit(EXIT_FAILURE);
+    if (streaming_)
+        stop();
+    if (!buffers.empty())
+        uninit();
+    if (fd_ != -1)
+        close();
 }
 
 
-int xioctl (int fh, int request, void *arg)
+std::string V4l2Device::describe (const char *s) const
 {
-    int r;
+    char message[256];
 
-    do
-    {
-        r = ioctl(fh, request, arg);
-    } while (-1 == r && EINTR == errno);
+    snprintf(message, sizeof(message), "%s: %s error %d, %s",
+             devName.c_str(), s, errno, strerror(errno));
+    return message;
+}
 
-    return r;
+bool V4l2Device::fail (const char *s)
+{
+    lastError = describe(s);
+    return false;
+}
+
+bool V4l2Device::failMessage (const std::string& message)
+{
+    lastError = devName + ": " + message;
+    return false;
 }
 
 
-int read_frame (void)
+int V4l2Device::readFrame (unsigned int* index, int64_t* timestamp, unsigned int* sequence)
 {
-    //struct v4l2_buffer buf;
+    struct v4l2_buffer buf;
     unsigned int i;
 
     switch (io)
     {
         case IO_METHOD_READ:
         {
-            if (-1 == read(fd, buffers[0].start, buffers[0].length))
+            if (-1 == read(fd_, buffers[0].start, buffers[0].length))
             {
                 switch (errno)
                 {
@@ -98,20 +118,26 @@ int read_frame (void)
                         /* fall through */
 
                     default:
-                        errno_exit("read");
+                        fail("read");
+                        return -1;
                 }
             }
 
+            /* No buffer metadata with read i/o */
+            *index = 0;
+            *timestamp = monotonic_us();
+            *sequence = 0;
             break;
         }
         case IO_METHOD_MMAP:
+        case IO_METHOD_USERPTR:
         {
             CLEAR(buf);
 
             buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            buf.memory = V4L2_MEMORY_MMAP;
+            buf.memory = io == IO_METHOD_MMAP ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
 
-            if (-1 == xioctl(fd, VIDIOC_DQBUF, &buf))
+            if (-1 == xioctl(fd_, VIDIOC_DQBUF, &buf))
             {
                 switch (errno)
                 {
@@ -124,110 +150,139 @@ int read_frame (void)
                         /* fall through */
 
                     default:
-                        errno_exit("VIDIOC_DQBUF");
+                        fail("VIDIOC_DQBUF");
+                        return -1;
                 }
             }
 
-            assert(buf.index < n_buffers);
-
-
+            if (io == IO_METHOD_USERPTR)
+            {
+                for (i = 0; i < nBuffers; ++i)
+                {
+                    if (buf.m.userptr == (unsigned long)buffers[i].start
+                        && buf.length == buffers[i].length)
+                        break;
+                }
+                buf.index = i;
+            }
+            assert(buf.index < nBuffers);
 
-            if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-                errno_exit("VIDIOC_QBUF");
+            /* The buffer stays with the caller until queue */
+            *index = buf.index;
+            *timestamp = (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+            *sequence = buf.sequence;
             break;
         }
-        case IO_METHOD_USERPTR:
-        {
-            CLEAR(buf);
+    }
 
-            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            buf.memory = V4L2_MEMORY_USERPTR;
+    return 1;
+}
 
-            if (-1 == xioctl(fd, VIDIOC_DQBUF, &buf))
-            {
-                switch (errno)
-                {
-                    case EAGAIN:
-                        return 0;
 
-                    case EIO:
-                        /* Could ignore EIO, see spec. */
+bool V4l2Device::queue (unsigned int index, std::string* error)
+{
+    struct v4l2_buffer qbuf;
 
-                        /* fall through */
+    /* The buffers are all dequeued by VIDIOC_STREAMOFF, a late release has nothing to give back */
+    if (!streaming_ || io == IO_METHOD_READ)
+        return true;
 
-                    default:
-                    {
-                        errno_exit("VIDIOC_DQBUF");
-                    }
-                }
-            }
+    CLEAR(qbuf);
+    qbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    qbuf.index = index;
+    if (io == IO_METHOD_MMAP)
+    {
+        qbuf.memory = V4L2_MEMORY_MMAP;
+    }
+    else
+    {
+        qbuf.memory = V4L2_MEMORY_USERPTR;
+        qbuf.m.userptr = (unsigned long)buffers[index].start;
+        qbuf.length = buffers[index].length;
+    }
 
-            for (i = 0; i < n_buffers; ++i)
-            {
-                if (buf.m.userptr == (unsigned long)buffers[i].start
-                    && buf.length == buffers[i].length)
-                    break;
-            }
-            assert(i < n_buffers);
+    if (-1 == xioctl(fd_, VIDIOC_QBUF, &qbuf))
+    {
+        if (!error)
+            return fail("VIDIOC_QBUF");
+        *error = describe("VIDIOC_QBUF");
+        return false;
+    }
+    return true;
+}
+
+
+unsigned char* V4l2Device::tryDequeue (unsigned int* index, int64_t* timestamp, unsigned int* sequence)
+{
+    unsigned int i, s;
+    int64_t t;
+
+    lastError.clear();
+    if (readFrame(&i, &t, &s) <= 0)
+        return NULL;
+
+    *index = i;
+    if (timestamp)
+        *timestamp = t;
+    if (sequence)
+        *sequence = s;
+    return (unsigned char*)buffers[i].start;
+}
 
 
+unsigned char* V4l2Device::dequeue (unsigned int* index, int64_t* timestamp, unsigned int* sequence, int timeoutMs)
+{
+    int64_t deadline = monotonic_us() + (int64_t)timeoutMs * 1000;
 
-            if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
-            {
-                errno_exit("VIDIOC_QBUF");
-            }
-            break;
+    for (;;)
+    {
+        struct pollfd pfd;
+        int r, left;
+
+        unsigned char* frame = tryDequeue(index, timestamp, sequence);
+        if (frame || !lastError.empty())
+            return frame;
+        /* EAGAIN - wait for the next frame. */
+
+        left = (int)((deadline - monotonic_us() + 999) / 1000);
+        if (left <= 0)
+        {
+            failMessage("no frame within the timeout");
+            return NULL;
         }
-    }
 
-    return 1;
+        pfd.fd = fd_;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        r = poll(&pfd, 1, left);
+
+        if (-1 == r && EINTR != errno)
+        {
+            fail("poll");
+            return NULL;
+        }
+    }
 }
 
 
-unsigned char* snapFrame()
+unsigned char* V4l2Device::snapFrame ()
 {
-      //printf("Start snapFrame\n");
-      for (;;)
-      {
-	  fd_set fds;
-	  struct timeval tv;
-	  int r;
-
-	  FD_ZERO(&fds);
-	  FD_SET(fd, &fds);
-
-	  /* Timeout. */
-	  tv.tv_sec = 2;
-	  tv.tv_usec = 0;
-
-	  r = select(fd + 1, &fds, NULL, NULL, &tv);
-
-	  if (-1 == r)
-	  {
-	      if (EINTR == errno)
-		  continue;
-	      errno_exit("select");
-	  }
-
-	  if (0 == r)
-	  {
-	      fprintf(stderr, "select timeout\n");
-	      exit(EXIT_FAILURE);
-	  }
-
-	  if (read_frame())
-	      break;
-	  /* EAGAIN - continue select loop. */
-      }
-      //printf("End snapFrame\n");
-
-     // v4l2_buffer* pI = ((v4l2_buffer*)buffers[buf.index].start);
-      //return pI;
-      return (unsigned char*)buffers[buf.index].start;
-
+    unsigned int index;
+
+    /* The previous frame is given back only now, so that it is never
+       overwritten while the caller still reads it */
+    if (snapIndex >= 0 && !queue(snapIndex))
+        return NULL;
+    snapIndex = -1;
+
+    unsigned char* frame = dequeue(&index);
+    if (frame && io != IO_METHOD_READ)
+        snapIndex = index;
+    return frame;
 }
 
-void stop_capturing (void)
+
+bool V4l2Device::stop ()
 {
     enum v4l2_buf_type type;
 
@@ -241,15 +296,16 @@ void stop_capturing (void)
         case IO_METHOD_MMAP:
         case IO_METHOD_USERPTR:
             type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            if (-1 == xioctl(fd, VIDIOC_STREAMOFF, &type))
-            {
-                errno_exit("VIDIOC_STREAMOFF");
-            }
+            if (-1 == xioctl(fd_, VIDIOC_STREAMOFF, &type))
+                return fail("VIDIOC_STREAMOFF");
             break;
     }
+    streaming_ = false;
+    snapIndex = -1;
+    return true;
 }
 
-void start_capturing (void)
+bool V4l2Device::start ()
 {
     unsigned int i;
     enum v4l2_buf_type type;
@@ -262,102 +318,84 @@ void start_capturing (void)
             break;
         }
         case IO_METHOD_MMAP:
+        case IO_METHOD_USERPTR:
         {
-            for (i = 0; i < n_buffers; ++i)
+            for (i = 0; i < nBuffers; ++i)
             {
                 struct v4l2_buffer buf;
 
                 CLEAR(buf);
                 buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                buf.memory = V4L2_MEMORY_MMAP;
                 buf.index = i;
-
-                if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+                if (io == IO_METHOD_MMAP)
                 {
-                    errno_exit("VIDIOC_QBUF");
+                    buf.memory = V4L2_MEMORY_MMAP;
                 }
-            }
-            type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            if (-1 == xioctl(fd, VIDIOC_STREAMON, &type))
-            {
-                errno_exit("VIDIOC_STREAMON");
-            }
-            break;
-        }
-        case IO_METHOD_USERPTR:
-        {
-            for (i = 0; i < n_buffers; ++i)
-            {
-                struct v4l2_buffer buf;
-
-                CLEAR(buf);
-                buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                buf.memory = V4L2_MEMORY_USERPTR;
-                buf.index = i;
-                buf.m.userptr = (unsigned long)buffers[i].start;
-                buf.length = buffers[i].length;
-
-                if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+                else
                 {
-                    errno_exit("VIDIOC_QBUF");
+                    buf.memory = V4L2_MEMORY_USERPTR;
+                    buf.m.userptr = (unsigned long)buffers[i].start;
+                    buf.length = buffers[i].length;
                 }
+
+                if (-1 == xioctl(fd_, VIDIOC_QBUF, &buf))
+                    return fail("VIDIOC_QBUF");
             }
             type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            if (-1 == xioctl(fd, VIDIOC_STREAMON, &type))
-            {
-                errno_exit("VIDIOC_STREAMON");
-            }
+            if (-1 == xioctl(fd_, VIDIOC_STREAMON, &type))
+                return fail("VIDIOC_STREAMON");
             break;
         }
     }
+    streaming_ = true;
+    return true;
 }
 
-void uninit_device (void)
+bool V4l2Device::uninit ()
 {
     unsigned int i;
+    bool ok = true;
 
     switch (io)
     {
         case IO_METHOD_READ:
-            free(buffers[0].start);
+            if (!buffers.empty())
+                free(buffers[0].start);
             break;
 
         case IO_METHOD_MMAP:
-            for (i = 0; i < n_buffers; ++i)
+            for (i = 0; i < nBuffers; ++i)
                 if (-1 == munmap(buffers[i].start, buffers[i].length))
-                    errno_exit("munmap");
+                    ok = fail("munmap");
             break;
 
         case IO_METHOD_USERPTR:
-            for (i = 0; i < n_buffers; ++i)
+            for (i = 0; i < nBuffers; ++i)
                 free(buffers[i].start);
             break;
     }
 
-    free(buffers);
+    buffers.clear();
+    nBuffers = 0;
+    return ok;
 }
 
-void init_read (unsigned int buffer_size)
+bool V4l2Device::initRead (unsigned int bufferSize)
 {
-    buffers = (buffer*)(calloc(1, sizeof(*buffers)));
+    Buffer b;
 
-    if (!buffers)
-    {
-        fprintf(stderr, "Out of memory\n");
-        exit(EXIT_FAILURE);
-    }
+    b.length = bufferSize;
+    b.start = malloc(bufferSize);
 
-    buffers[0].length = buffer_size;
-    buffers[0].start = malloc(buffer_size);
+    if (!b.start)
+        return failMessage("out of memory");
 
-    if (!buffers[0].start)
-    {
-        fprintf(stderr, "Out of memory\n");
-        exit(EXIT_FAILURE);
-    }
+    buffers.assign(1, b);
+    nBuffers = 1;
+    return true;
 }
 
-void init_mmap (void)
+bool V4l2Device::initMmap ()
 {
     struct v4l2_requestbuffers req;
 
@@ -367,62 +405,47 @@ void init_mmap (void)
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_MMAP;
 
-    if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req))
+    if (-1 == xioctl(fd_, VIDIOC_REQBUFS, &req))
     {
         if (EINVAL == errno)
-        {
-            fprintf(stderr, "%s does not support "
-                    "memory mapping\n", dev_name);
-            exit(EXIT_FAILURE);
-        }
-        else
-        {
-            errno_exit("VIDIOC_REQBUFS");
-        }
+            return failMessage("memory mapping not supported");
+        return fail("VIDIOC_REQBUFS");
     }
 
-    if (req.count < 2)                          \
-    {
-        fprintf(stderr, "Insufficient buffer memory on %s\n",
-                dev_name);
-        exit(EXIT_FAILURE);
-    }
-
-    buffers = (buffer*)calloc(req.count, sizeof(*buffers));
-
-    if (!buffers)
-    {
-        fprintf(stderr, "Out of memory\n");
-        exit(EXIT_FAILURE);
-    }
+    if (req.count < 2)
+        return failMessage("insufficient buffer memory");
 
-    for (n_buffers = 0; n_buffers < req.count; ++n_buffers)
+    buffers.clear();
+    for (nBuffers = 0; nBuffers < req.count; ++nBuffers)
     {
         struct v4l2_buffer buf;
+        Buffer b;
 
         CLEAR(buf);
 
         buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         buf.memory      = V4L2_MEMORY_MMAP;
-        buf.index       = n_buffers;
+        buf.index       = nBuffers;
 
-        if (-1 == xioctl(fd, VIDIOC_QUERYBUF, &buf))
-            errno_exit("VIDIOC_QUERYBUF");
+        if (-1 == xioctl(fd_, VIDIOC_QUERYBUF, &buf))
+            return fail("VIDIOC_QUERYBUF");
 
-        buffers[n_buffers].length = buf.length;
-        buffers[n_buffers].start =
+        b.length = buf.length;
+        b.start =
             mmap(NULL /* start anywhere */,
                  buf.length,
                  PROT_READ | PROT_WRITE /* required */,
                  MAP_SHARED /* recommended */,
-                 fd, buf.m.offset);
+                 fd_, buf.m.offset);
 
-        if (MAP_FAILED == buffers[n_buffers].start)
-            errno_exit("mmap");
+        if (MAP_FAILED == b.start)
+            return fail("mmap");
+        buffers.push_back(b);
     }
+    return true;
 }
 
-void init_userp (unsigned int buffer_size)
+bool V4l2Device::initUserp (unsigned int bufferSize)
 {
     struct v4l2_requestbuffers req;
 
@@ -432,82 +455,61 @@ void init_userp (unsigned int buffer_size)
     req.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     req.memory = V4L2_MEMORY_USERPTR;
 
-    if (-1 == xioctl(fd, VIDIOC_REQBUFS, &req))
+    if (-1 == xioctl(fd_, VIDIOC_REQBUFS, &req))
     {
         if (EINVAL == errno)
-        {
-            fprintf(stderr, "%s does not support "
-                    "user pointer i/o\n", dev_name);
-            exit(EXIT_FAILURE);
-        }
-        else
-        {
-            errno_exit("VIDIOC_REQBUFS");
-        }
+            return failMessage("user pointer i/o not supported");
+        return fail("VIDIOC_REQBUFS");
     }
 
-    buffers = (buffer*)calloc(4, sizeof(*buffers));
-
-    if (!buffers)
+    buffers.clear();
+    for (nBuffers = 0; nBuffers < 4; ++nBuffers)
     {
-        fprintf(stderr, "Out of memory\n");
-        exit(EXIT_FAILURE);
-    }
+        Buffer b;
 
-    for (n_buffers = 0; n_buffers < 4; ++n_buffers)
-    {
-        buffers[n_buffers].length = buffer_size;
-        buffers[n_buffers].start = malloc(buffer_size);
+        b.length = bufferSize;
+        b.start = malloc(bufferSize);
 
-        if (!buffers[n_buffers].start)
-        {
-            fprintf(stderr, "Out of memory\n");
-            exit(EXIT_FAILURE);
-        }
+        if (!b.start)
+            return failMessage("out of memory");
+        buffers.push_back(b);
     }
+    return true;
 }
 
 
-static int set_exposure(int exposure_time, int fd)
+bool V4l2Device::setExposure (int exposureTime)
 {
-	struct v4l2_control control;
+    struct v4l2_control control;
 
-	CLEAR(control);
+    CLEAR(control);
 
-	control.value = exposure_time;
+    /* change the exposure time */
+    control.id = V4L2_CID_EXPOSURE_ABSOLUTE;
+    control.value = exposureTime*10;
+    if (xioctl(fd_, VIDIOC_S_CTRL, &control) == -1)
+        return fail("VIDIOC_S_CTRL set exposure time");
 
-	/* change the exposure time */
-	control.id = V4L2_CID_EXPOSURE_ABSOLUTE;
-	control.value = exposure_time*10;
-	if (xioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
-		perror("VIDIOC_S_CTRL set exposure time");
-		return -errno;
-	}
-
-	return 0;
+    return true;
 }
 
 
-static int set_gain(int new_gain, int fd)
+bool V4l2Device::setGain (int gain)
 {
-	struct v4l2_control control;
-
-	CLEAR(control);
-
-	control.value = new_gain;
+    struct v4l2_control control;
 
+    CLEAR(control);
 
-	/* change the analog gain */
-	control.id = V4L2_CID_GAIN;
-	if (xioctl(fd, VIDIOC_S_CTRL, &control) == -1) {
-		perror("VIDIOC_S_CTRL set analog gain");
-		return -errno;
-	}
+    /* change the analog gain */
+    control.id = V4L2_CID_GAIN;
+    control.value = gain;
+    if (xioctl(fd_, VIDIOC_S_CTRL, &control) == -1)
+        return fail("VIDIOC_S_CTRL set analog gain");
 
-	return 0;
+    return true;
 }
 
-void init_device ( int width,int height)
+bool V4l2Device::init (int width, int height, bool forceFormat)
 {
     struct v4l2_capability cap;
     struct v4l2_cropcap cropcap;
@@ -515,51 +517,29 @@ void init_device ( int width,int height)
     struct v4l2_format fmt;
     unsigned int min;
 
-    if (-1 == xioctl(fd, VIDIOC_QUERYCAP, &cap))
+    if (-1 == xioctl(fd_, VIDIOC_QUERYCAP, &cap))
     {
         if (EINVAL == errno)
-        {
-            fprintf(stderr,
-                    "%s is no V4L2 device\n",
-                    dev_name);
-            exit(EXIT_FAILURE);
-        }
-        else
-        {
-            errno_exit("VIDIOC_QUERYCAP");
-        }
+            return failMessage("no V4L2 device");
+        return fail("VIDIOC_QUERYCAP");
     }
 
     if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE))
-    {
-        fprintf(stderr,
-                "%s is no video capture device\n",
-                dev_name);
-        exit(EXIT_FAILURE);
-    }
+        return failMessage("no video capture device");
 
     switch (io)
     {
         case IO_METHOD_READ:
         {
             if (!(cap.capabilities & V4L2_CAP_READWRITE))
-            {
-                fprintf(stderr,
-                        "%s does not support read i/o\n",
-                        dev_name);
-                exit(EXIT_FAILURE);
-            }
+                return failMessage("read i/o not supported");
             break;
         }
         case IO_METHOD_MMAP:
         case IO_METHOD_USERPTR:
         {
             if (!(cap.capabilities & V4L2_CAP_STREAMING))
-            {
-                fprintf(stderr, "%s does not support streaming i/o\n",
-                        dev_name);
-                exit(EXIT_FAILURE);
-            }
+                return failMessage("streaming i/o not supported");
             break;
         }
     }
@@ -572,23 +552,13 @@ void init_device ( int width,int height)
 
     cropcap.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-    if (0 == xioctl(fd, VIDIOC_CROPCAP, &cropcap))
+    if (0 == xioctl(fd_, VIDIOC_CROPCAP, &cropcap))
     {
         crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         crop.c = cropcap.defrect; /* reset to default */
 
-        if (-1 == xioctl(fd, VIDIOC_S_CROP, &crop))
-        {
-            switch (errno)
-            {
-                case EINVAL:
-                    /* Cropping not supported. */
-                    break;
-                default:
-                    /* Errors ignored. */
-                    break;
-            }
-        }
+        /* Errors ignored, cropping may not be supported. */
+        xioctl(fd_, VIDIOC_S_CROP, &crop);
     }
     else
     {
@@ -599,25 +569,31 @@ void init_device ( int width,int height)
     CLEAR(fmt);
 
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (force_format)
+    if (forceFormat)
     {
         fmt.fmt.pix.width       = width;
         fmt.fmt.pix.height      = height;
         fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_GREY;
         fmt.fmt.pix.field       = V4L2_FIELD_NONE;
 
-        if (-1 == xioctl(fd, VIDIOC_S_FMT, &fmt))
-            errno_exit("VIDIOC_S_FMT");
+        if (-1 == xioctl(fd_, VIDIOC_S_FMT, &fmt))
+            return fail("VIDIOC_S_FMT");
 
         /* Note VIDIOC_S_FMT may change width and height. */
     }
     else
     {
         /* Preserve original settings as set by v4l2-ctl for example */
-        if (-1 == xioctl(fd, VIDIOC_G_FMT, &fmt))
-            errno_exit("VIDIOC_G_FMT");
+        if (-1 == xioctl(fd_, VIDIOC_G_FMT, &fmt))
+            return fail("VIDIOC_G_FMT");
     }
 
+    /* Layout of the frames as reported by the driver (8 bit grey), before the
+       paranoia below which assumes 2 bytes per pixel */
+    frameWidth = fmt.fmt.pix.width;
+    frameHeight = fmt.fmt.pix.height;
+    frameStride = fmt.fmt.pix.bytesperline > 0 ? (int)fmt.fmt.pix.bytesperline : frameWidth;
+
     /* Buggy driver paranoia. */
     min = fmt.fmt.pix.width * 2;
     if (fmt.fmt.pix.bytesperline < min)
@@ -627,21 +603,24 @@ void init_device ( int width,int height)
         fmt.fmt.pix.sizeimage = min;
 
 
-    set_exposure(300,fd);
-    set_gain(4,fd);
+    /* Not every camera has these controls (vivid has neither), not fatal */
+    if (!setExposure(300) || !setGain(4))
+        fprintf(stderr, "%s\n", lastError.c_str());
+    lastError.clear();
 
+    bool ok = false;
     switch (io)
     {
         case IO_METHOD_READ:
-            init_read(fmt.fmt.pix.sizeimage);
+            ok = initRead(fmt.fmt.pix.sizeimage);
             break;
 
         case IO_METHOD_MMAP:
-            init_mmap();
+            ok = initMmap();
             break;
 
         case IO_METHOD_USERPTR:
-            init_userp(fmt.fmt.pix.sizeimage);
+            ok = initUserp(fmt.fmt.pix.sizeimage);
             break;
     }
 
@@ -649,7 +628,7 @@ void init_device ( int width,int height)
 //    v4l2_control c;
 //    c.id = V4L2_CID_EXPOSURE_AUTO;
 //    c.value = V4L2_EXPOSURE_MANUAL;
-//    if(-1 == xioctl(fd, VIDIOC_S_CTRL, &c))
+//    if(-1 == xioctl(fd_, VIDIOC_S_CTRL, &c))
 //    {
 //    	printf("Error :(\n");
 //    }
@@ -658,42 +637,140 @@ void init_device ( int width,int height)
 //    // auto priority control
 //    c.id = V4L2_CID_EXPOSURE_AUTO_PRIORITY;
 //    c.value = 0;
-//    if(v4l2_ioctl(fd, VIDIOC_S_CTRL, &c) == 0)
+//    if(v4l2_ioctl(fd_, VIDIOC_S_CTRL, &c) == 0)
 //        printf("y \n");
 
   //  capture.set( CV_CAP_PROP_EXPOSURE, 100);
    // capture.set(cv::CAP_PROP_AUTO_EXPOSURE, 0.25) // where 0.25 means "manual exposure, manual iris"
+    return ok;
 }
 
-void close_device(void)
+bool V4l2Device::close ()
 {
-    if (-1 == close(fd))
-        errno_exit("close");
+    int r = ::close(fd_);
 
-    fd = -1;
+    fd_ = -1;
+    if (-1 == r)
+        return fail("close");
+    return true;
 }
 
-void open_device(char* devicename)
+bool V4l2Device::open (const char* devicename)
 {
     struct stat st;
-    strcpy( dev_name,devicename);
 
-    if (-1 == stat(dev_name, &st)) {
-        fprintf(stderr, "Cannot identify '%s': %d, %s\n",
-                dev_name, errno, strerror(errno));
-        exit(EXIT_FAILURE);
+    devName = devicename;
+    lastError.clear();
+
+    if (-1 == stat(devicename, &st))
+        return fail("stat");
+
+    if (!S_ISCHR(st.st_mode))
+        return failMessage("no device");
+
+    fd_ = ::open(devicename, O_RDWR /* required */ | O_NONBLOCK, 0);
+
+    if (-1 == fd_)
+        return fail("open");
+    return true;
+}
+
+
+V4l2MultiCapture::V4l2MultiCapture ()
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+V4l2MultiCapture::~V4l2MultiCapture ()
+{
+    if (epfd != -1)
+        ::close(epfd);
+}
+
+int V4l2MultiCapture::add (V4l2Device* device)
+{
+    struct epoll_event ev;
+
+    if (-1 == epfd)
+    {
+        lastError = std::string("epoll_create1: ") + strerror(errno);
+        return -1;
     }
 
-    if (!S_ISCHR(st.st_mode)) {
-        fprintf(stderr, "%s is no device\n", dev_name);
-        exit(EXIT_FAILURE);
+    CLEAR(ev);
+    ev.events = EPOLLIN;
+    ev.data.u32 = devices.size();
+    if (-1 == epoll_ctl(epfd, EPOLL_CTL_ADD, device->fd(), &ev))
+    {
+        lastError = std::string(device->name()) + ": epoll_ctl: " + strerror(errno);
+        return -1;
     }
+    devices.push_back(device);
+    return (int)devices.size() - 1;
+}
 
-    fd = open(dev_name, O_RDWR /* required */ | O_NONBLOCK, 0);
+int V4l2MultiCapture::wait (std::vector<V4l2Frame>& frames, int timeoutMs)
+{
+    std::vector<struct epoll_event> events(devices.empty() ? 1 : devices.size());
+    int r, n = 0;
 
-    if (-1 == fd) {
-        fprintf(stderr, "Cannot open '%s': %d, %s\n",
-                dev_name, errno, strerror(errno));
-        exit(EXIT_FAILURE);
+    lastError.clear();
+    do
+    {
+        r = epoll_wait(epfd, &events[0], (int)events.size(), timeoutMs);
+    } while (-1 == r && EINTR == errno);
+
+    if (-1 == r)
+    {
+        lastError = std::string("epoll_wait: ") + strerror(errno);
+        return -1;
+    }
+
+    for (int e = 0; e < r; e++)
+    {
+        int d = (int)events[e].data.u32;
+        V4l2Device* device = devices[d];
+
+        if (events[e].events & EPOLLERR)
+        {
+            lastError = std::string(device->name()) + ": device error, unplugged or not streaming";
+            return -1;
+        }
+
+        /* Every frame queued since the last wait, the oldest first */
+        for (;;)
+        {
+            V4l2Frame frame;
+
+            frame.device = d;
+            frame.data = device->tryDequeue(&frame.index, &frame.timestamp, &frame.sequence);
+            if (!frame.data)
+            {
+                if (!device->error().empty())
+                {
+                    lastError = device->error();
+                    return -1;
+                }
+                break;
+            }
+            frames.push_back(frame);
+            n++;
+            /* read i/o has a single buffer, overwritten by the next read */
+            if (device->bufferCount() == 1)
+                break;
+        }
+    }
+    return n;
+}
+
+bool V4l2MultiCapture::release (const V4l2Frame& frame)
+{
+    std::string error;
+
+    if (!devices[frame.device]->queue(frame.index, &error))
+    {
+        lastError = error;
+        return false;
     }
+    return true;
 }
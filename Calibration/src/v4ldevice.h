@@ -1,14 +1,140 @@
-void open_device(char* devicename); 
- void close_device(void);
- void init_device (int width, int height );
- void init_userp (unsigned int buffer_size);
- void init_mmap (void);
- void init_read (unsigned int buffer_size);
- void uninit_device (void);
- void start_capturing (void);
- void stop_capturing (void);
- int read_frame (void);
- void errno_exit (const char *s);
- int xioctl (int fh, int request, void *arg);
- 
- unsigned char* snapFrame();
\ No newline at end of file
+/*
+ * v4ldevice.h
+ *
+ * V4L2 capture of 8 bit grey frames. Each V4l2Device owns the descriptor and
+ * the buffers of one /dev/videoN, so several cameras can be driven by one
+ * process; V4l2MultiCapture dequeues from several started devices in one
+ * thread. Failures are returned and described by error(), never exit().
+ */
+
+#ifndef SRC_V4LDEVICE_H_
+#define SRC_V4LDEVICE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+class V4l2Device
+{
+public:
+    enum IoMethod
+    {
+        IO_METHOD_READ,
+        IO_METHOD_MMAP,
+        IO_METHOD_USERPTR,
+    };
+
+    V4l2Device(IoMethod io = IO_METHOD_MMAP);
+    /* Stops, uninitializes and closes whatever is still open */
+    ~V4l2Device();
+
+    bool open(const char* devicename);
+    bool close();
+    /* Sets the format to width x height grey, or keeps the current one with
+       forceFormat false, and allocates the buffers */
+    bool init(int width, int height, bool forceFormat = true);
+    bool uninit();
+    bool start();
+    bool stop();
+
+    /* Dequeues a frame that stays with the caller until queue(index). Waits
+       at most timeoutMs, NULL on timeout or failure. The timestamp is the one
+       of the driver, in microseconds of CLOCK_MONOTONIC for most drivers. */
+    unsigned char* dequeue(unsigned int* index, int64_t* timestamp = NULL,
+                           unsigned int* sequence = NULL, int timeoutMs = 2000);
+    /* Same without waiting: NULL with an empty error() when no frame is ready */
+    unsigned char* tryDequeue(unsigned int* index, int64_t* timestamp = NULL,
+                              unsigned int* sequence = NULL);
+    /* Gives the buffer back to the driver. With error, it may be called from
+       another thread than the capture one: a failure is described in *error
+       and error() is left alone. */
+    bool queue(unsigned int index, std::string* error = NULL);
+
+    /* Dequeues a frame and gives the previous one back to the driver: the
+       returned buffer stays valid until the next call */
+    unsigned char* snapFrame();
+
+    bool setExposure(int exposureTime);
+    bool setGain(int gain);
+
+    int fd() const { return fd_; }
+    const char* name() const { return devName.c_str(); }
+    int width() const { return frameWidth; }
+    int height() const { return frameHeight; }
+    int stride() const { return frameStride; }
+    unsigned int bufferCount() const { return nBuffers; }
+    bool streaming() const { return streaming_; }
+    /* Description of the last failure, empty after a success */
+    const std::string& error() const { return lastError; }
+
+private:
+    struct Buffer
+    {
+        void   *start;
+        size_t  length;
+    };
+
+    V4l2Device(const V4l2Device&);
+    V4l2Device& operator=(const V4l2Device&);
+
+    /* 1 with a frame, 0 when none is ready, -1 on failure */
+    int readFrame(unsigned int* index, int64_t* timestamp, unsigned int* sequence);
+    bool initRead(unsigned int bufferSize);
+    bool initMmap();
+    bool initUserp(unsigned int bufferSize);
+    bool fail(const char* s);
+    std::string describe(const char* s) const;
+    bool failMessage(const std::string& message);
+
+    IoMethod io;
+    std::string devName;
+    int fd_;
+    std::vector<Buffer> buffers;
+    unsigned int nBuffers;
+    std::atomic<bool> streaming_;
+    int frameWidth, frameHeight, frameStride;
+    /* Buffer returned by snapFrame, given back to the driver at the next call */
+    int snapIndex;
+    std::string lastError;
+};
+
+/* Frame dequeued by V4l2MultiCapture, to give back with release() */
+struct V4l2Frame
+{
+    int device;            /* index of the device in the order of add() */
+    unsigned int index;    /* buffer of the device */
+    unsigned char* data;
+    int64_t timestamp;     /* microseconds, from the v4l2_buffer */
+    unsigned int sequence; /* frame counter of the driver, gaps are dropped frames */
+};
+
+/* Waits on the descriptors of several started devices with epoll and dequeues
+   every frame ready, so that one thread captures all the cameras. */
+class V4l2MultiCapture
+{
+public:
+    V4l2MultiCapture();
+    ~V4l2MultiCapture();
+
+    /* The device must stay open while it is captured, index of the device */
+    int add(V4l2Device* device);
+    /* Appends the frames ready within timeoutMs to frames: their number, 0
+       on timeout, -1 on failure */
+    int wait(std::vector<V4l2Frame>& frames, int timeoutMs);
+    bool release(const V4l2Frame& frame);
+
+    V4l2Device* device(int i) const { return devices[i]; }
+    int size() const { return (int)devices.size(); }
+    const std::string& error() const { return lastError; }
+
+private:
+    V4l2MultiCapture(const V4l2MultiCapture&);
+    V4l2MultiCapture& operator=(const V4l2MultiCapture&);
+
+    int epfd;
+    std::vector<V4l2Device*> devices;
+    std::string lastError;
+};
+
+#endif /* SRC_V4LDEVICE_H_ */
@@ -0,0 +1,130 @@
+/*
+ * viewSelection.hpp
+ *
+ * Selection of a subset of the detected views that covers the field of view,
+ * to calibrate on fewer views with about the same accuracy.
+ */
+
+#ifndef SRC_VIEWSELECTION_HPP_
+#define SRC_VIEWSELECTION_HPP_
+
+#include <opencv2/core.hpp>
+#include "omnidirExt.hpp"
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+// Each view is described by the bins it covers: a bin is a cell of a grid over
+// the image, or over longitude/latitude on the unit sphere once a model is
+// set, combined with the direction of the board rows in the image. The views
+// are picked greedily, each time the one adding the most bins not covered yet,
+// until the budget is reached or no view adds anything. Ties go to the first
+// view so the selection is deterministic.
+class ViewSelector {
+public:
+	ViewSelector(Size imageSize, Size boardSize) :
+			imageSize(imageSize), boardSize(boardSize), grid(8, 8), orientationBins(8), xi(0) {
+	}
+
+	// Bins over the sphere, with the bearings of the corners given by the model
+	void setModel(const Mat &K, const Mat &D, double xi) {
+		K.convertTo(this->K, CV_64F);
+		D.convertTo(this->D, CV_64F);
+		this->xi = xi;
+	}
+
+	// Indices of the selected views in increasing order, budget <= 0 for no limit
+	void select(const vector<Mat> &imagePoints, int budget, vector<int> &selected) const {
+		int n = (int) imagePoints.size();
+		vector<vector<int> > bins(n);
+		for (int i = 0; i < n; i++)
+			viewBins(imagePoints[i], bins[i]);
+
+		vector<bool> covered(grid.area() * orientationBins, false), taken(n, false);
+		selected.clear();
+		while (budget <= 0 || (int) selected.size() < budget) {
+			int best = -1, bestGain = 0;
+			for (int i = 0; i < n; i++) {
+				if (taken[i])
+					continue;
+				int gain = 0;
+				for (size_t k = 0; k < bins[i].size(); k++)
+					gain += !covered[bins[i][k]];
+				if (gain > bestGain) {
+					best = i;
+					bestGain = gain;
+				}
+			}
+			if (best < 0)
+				break;
+			taken[best] = true;
+			selected.push_back(best);
+			for (size_t k = 0; k < bins[best].size(); k++)
+				covered[bins[best][k]] = true;
+		}
+		std::sort(selected.begin(), selected.end());
+	}
+
+	// Bins covered by one view, for a selection made as the views come
+	void bins(const Mat &imagePoints, vector<int> &bins) const {
+		viewBins(imagePoints, bins);
+	}
+
+	int binCount() const {
+		return grid.area() * orientationBins;
+	}
+
+	Size imageSize;
+	Size boardSize;
+	Size grid;           // cells over the image, or longitude x latitude cells over the sphere
+	int orientationBins; // bins of the direction of the board rows
+
+private:
+	void viewBins(const Mat &points, vector<int> &bins) const {
+		Mat p = points.reshape(2, (int) points.total());
+		CV_Assert(p.type() == CV_64FC2 && (int) p.total() == boardSize.area());
+
+		// direction of the first row of the board, from its first to its last corner
+		Vec2d d = p.at<Vec2d>(boardSize.width - 1) - p.at<Vec2d>(0);
+		double angle = std::atan2(d[1], d[0]) + CV_PI;
+		int orientation = std::min((int) (angle / (2 * CV_PI) * orientationBins), orientationBins - 1);
+
+		Mat bearings;
+		if (!K.empty())
+			lift(p, bearings);
+
+		set<int> cells;
+		for (int i = 0; i < (int) p.total(); i++) {
+			double u, v;
+			if (bearings.empty()) {
+				Vec2d q = p.at<Vec2d>(i);
+				u = q[0] / imageSize.width;
+				v = q[1] / imageSize.height;
+			} else {
+				Vec3d b = bearings.at<Vec3d>(i);
+				u = (std::atan2(b[1], b[0]) + CV_PI) / (2 * CV_PI);
+				v = std::acos(std::max(-1.0, std::min(1.0, b[2]))) / CV_PI;
+			}
+			int cx = std::max(0, std::min((int) (u * grid.width), grid.width - 1));
+			int cy = std::max(0, std::min((int) (v * grid.height), grid.height - 1));
+			cells.insert(cy * grid.width + cx);
+		}
+		bins.clear();
+		for (set<int>::const_iterator it = cells.begin(); it != cells.end(); ++it)
+			bins.push_back(*it * orientationBins + orientation);
+	}
+
+	// Unit bearings of the image points, the inverse of the Mei projection
+	void lift(const Mat &p, Mat &bearings) const {
+		omnidir::imagePointsToBearings(p, bearings, K, D, xi);
+	}
+
+	Mat K, D;
+	double xi;
+};
+
+#endif /* SRC_VIEWSELECTION_HPP_ */
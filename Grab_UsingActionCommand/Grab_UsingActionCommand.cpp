@@ -3,9 +3,12 @@
    This program grabs images from the camera and saves in raw format.
    It displays the images on the screen.
    There are three threads:
-   One that grabs the image and saves in a buffer.
-   Another saves the buffer to a file.
+   One that grabs the image and saves in a ring of buffers.
+   Another saves the images requested to a file.
    The third one displays the image.
+   The threads share the images through the ring only, without waiting for
+   each other: the capture runs at the rate of the camera whatever the time
+   taken by the display or the disk.
 */
 
 // Include files to use OpenCV API
@@ -31,6 +34,10 @@
 
 // To manage threads
 #include <pthread.h>
+#include <atomic>
+#include <thread>
+
+#include "frameRing.h"
 
 // Settings to use Basler GigE cameras.
 using namespace Basler_GigECameraParams;
@@ -75,19 +82,6 @@ const int autoTargetVal = 100;
 
 // Image buffers
 const unsigned long int imageBufferSize = imageWidth * imageHeight; // Unpacked 8-bit per pixel
-uint8_t rawImageBuffer[imageBufferSize];
-
-// Flags to control access to the buffers
-bool bufferOpenCvReadable = false;
-bool bufferRawReadable = false;
-bool saveImage = false;
-
-// Barrier to synchronize the threads
-pthread_barrier_t thBarrier;
-// Markers for the barrier
-int barrier_0 = 0;
-int barrier_1 = 0;
-int barrier_2 = 0;
 
 // Passing arguments to the thread
 struct thread_data {
@@ -112,11 +106,16 @@ struct image_data {
 	int autoGain;
 };
 
-image_data imageData[2] = {{0, 0, 0, 0, 0, 0, 0, 0, 0},  // Struct where information of the images are stored
-						   {0, 0, 0, 0, 0, 0, 0, 0, 0}};
+// Last images grabbed, with their information. The capture overwrites the
+// oldest one; the display and the saving thread each read at their own pace.
+const int ringSlots = 8;
+FrameRing<image_data> frameRing(ringSlots, imageBufferSize);
+
+// Images to save, requested with the 't' key
+std::atomic<int> saveRequests(0);
 
 // Boolean to exit loops in thread
-bool terminateLoop = false;
+std::atomic<bool> terminateLoop(false);
 // Counts the number images grabbed
 int numGrabbedImages = 0;
 // Counts number of grab errors
@@ -146,9 +145,8 @@ int main(int argc, char* argv[])
 	// and create image file names with ascending number.
 	int grabbedImages = 0;
 
-	// Set up the threads and barrier
+	// Set up the threads
 	const int NUM_THREAD = 3;
-	const int THREAD_BARRIER_COUNT = 3;
 
 	int rc;
 	int i;
@@ -156,8 +154,6 @@ int main(int argc, char* argv[])
 
 	struct thread_data td[NUM_THREAD];
 
-	pthread_barrier_init(&thBarrier, NULL, THREAD_BARRIER_COUNT);
-
 	double expTime[2] {0, 0};
 	int gain[2] {0, 0};
 
@@ -323,6 +319,9 @@ int main(int argc, char* argv[])
 		// Create an OpenCV image.
 		Mat openCvImage;
 		Mat openCvImageRG8;
+		// The display shows the newest image and skips those it had no time for
+		FrameRing<image_data>::Reader display(FrameRing<image_data>::LATEST);
+		uint64_t sequence;
 
 		// Measure the starting of grabbing
 		t1 = high_resolution_clock::now();
@@ -332,16 +331,24 @@ int main(int argc, char* argv[])
 		int key = 0;
 
 		while (!terminateLoop) {
-			if (bufferOpenCvReadable) {
+			const uint8_t *rawImage = NULL;
+			if (frameRing.next(display, sequence))
+				rawImage = frameRing.peek(sequence);
+			if (rawImage != NULL) {
 
 				cout << "thread " << thread_id << ": Start displaying image number " << imageNum << endl;
 
 				//intptr_t cameraIndex = ptrGrabResult1->GetCameraContext();
 				const int cameraIndex = 0;
 
-				openCvImageRG8 = cv::Mat(imageHeight, imageWidth, CV_8UC1, rawImageBuffer);
+				// Converted in place in the ring, shown only if the capture did not overwrite it meanwhile
+				openCvImageRG8 = cv::Mat(imageHeight, imageWidth, CV_8UC1, (void *) rawImage);
 
 				cvtColor(openCvImageRG8, openCvImage, COLOR_BayerRG2RGB);
+				if (!frameRing.valid(sequence)) {
+					cout << "thread " << thread_id << ": Image overwritten while converted" << endl;
+					continue;
+				}
 
 				// Specify the name of the window to show
 				String windowTitle = "Camera " + to_string(cameraIndex);
@@ -360,20 +367,16 @@ int main(int argc, char* argv[])
 				if (key == 113) // if 'q' key is pressed
 					terminateLoop = true;
 				if (key == 116) // if 't' key is pressed
-					saveImage = true;
+					saveRequests++;
 
 				cout << "thread " << thread_id << ": Finished displaying buffer." << endl;
 				imageNum++;
 
 
+			} else {
+				// No new image yet
+				std::this_thread::sleep_for(milliseconds(1));
 			}
-
-			cout << "thread " << thread_id << ": Barrier 1" << endl;
-			barrier_0 = 1;
-			pthread_barrier_wait(&thBarrier);
-			cout << "thread " << thread_id << ": Barrier 2" << endl;
-			barrier_0 = 2;
-			pthread_barrier_wait(&thBarrier);
 		}
 
 		// Measure the end of the grabbing
@@ -395,6 +398,7 @@ int main(int argc, char* argv[])
 		cout << "time for grabbing: " << duration << " microseconds" << endl << flush;
 		cout << "fps: " << double(1000000) / duration * numGrabbedImages << endl;
 		cout << "Number of grabbing errors: " << numGrabError << endl;
+		cout << "Images not displayed: " << display.skipped << endl;
 
 		for (size_t i = 0; i < cameras.GetSize(); ++i) {
 			cameras[i].GainAuto.SetValue(GainAuto_Off);
@@ -415,8 +419,6 @@ int main(int argc, char* argv[])
         exitCode = 1;
     }
 
-    pthread_barrier_destroy(&thBarrier);
-
     // Comment the following two lines to disable waiting on exit.
     cerr << endl << "Press Enter to exit." << endl;
     while (cin.get() != '\n');
@@ -537,7 +539,6 @@ void* thCapture (void *threadarg) {
 
 		// Retrieve images from all cameras.
 		//for (size_t i = 0; i < passedData->usableDeviceInfos->size() && passedData->cameras->IsGrabbing(); ++i) {
-		size_t i = 0;
 
 			cout << "\tthread " << thread_id << ": Retrieve result" << endl;
 			// CInstantCameraArray::RetrieveResult will return grab results in the order they arrive.
@@ -551,10 +552,6 @@ void* thCapture (void *threadarg) {
 			auto tnow = std::chrono::system_clock::now();
 			imData[cameraIndex].captureTime = std::chrono::system_clock::to_time_t(tnow);
 
-			cout << "\tthread " << thread_id << ": Barrier 1" << endl;
-			barrier_1 = 1;
-			pthread_barrier_wait(&thBarrier);
-
 			// Image grabbed successfully?
 			if (ptrGrabResult->GrabSucceeded()) {
 
@@ -562,26 +559,14 @@ void* thCapture (void *threadarg) {
 
 				cout << "\tthread " << thread_id << ": Start copying buffer image number " << numGrabbedImages << endl;
 
-				// Copy image to raw image buffer1
-				memcpy(rawImageBuffer, pImageBuffer, imageBufferSize);
+				// Copy the image and its attributes to the oldest slot of the ring,
+				// so that they can be displayed and saved from different threads
+				frameRing.publish(pImageBuffer, imData[cameraIndex]);
 
-				bufferOpenCvReadable = true;
-				bufferRawReadable = true;
 				cout << "\tthread " << thread_id << ": Finished copying buffer" << endl;
 
 				numGrabbedImages++;
 
-				// Save the attributes into a global struct so that it can be saved from a different thread
-				imageData[i].cameraIdx = imData[i].cameraIdx;
-				imageData[i].exposureTime =	imData[i].exposureTime;
-				imageData[i].gain = imData[i].gain;
-				imageData[i].balanceR = imData[i].balanceR;
-				imageData[i].balanceG = imData[i].balanceG;
-				imageData[i].balanceB = imData[i].balanceB;
-				imageData[i].autoExpTime = imData[i].autoExpTime;
-				imageData[i].autoGain = imData[i].autoGain;
-				imageData[i].captureTime = imData[i].captureTime;
-
 
 			} else {
 				// If a buffer has been incompletely grabbed, the network bandwidth is possibly insufficient for transferring
@@ -589,7 +574,6 @@ void* thCapture (void *threadarg) {
 				cout << "Error: " << ptrGrabResult->GetErrorCode() << " "
 						<< ptrGrabResult->GetErrorDescription() << endl;
 				numGrabError++;
-				bufferRawReadable = false;
 			}
 
 		//}
@@ -657,19 +641,10 @@ void* thCapture (void *threadarg) {
 		cout << "\tthread " << thread_id << ": Issue Action Command" << endl;
 		passedData->pTL->IssueActionCommand(passedData->DeviceKey, passedData->GroupKey, AllGroupMask, passedData->subnet);
 
-		cout << "\tthread " << thread_id << ": Barrier 2" << endl;
-		barrier_1 = 2;
-		pthread_barrier_wait(&thBarrier);
 		cout << "-----------------------------------------------------------------" << endl;
 
 	}
 
-	// This is to put the barriers when the terminate loop is set to one while reading the camera parameters
-	if (barrier_2 == 1){
-		pthread_barrier_wait(&thBarrier);
-		pthread_barrier_wait(&thBarrier);
-	}
-
 	passedData->cameras->StopGrabbing();
 
 	pthread_exit(NULL);
@@ -684,13 +659,42 @@ void* thSave (void *threadarg) {
 
 	int imageNum = 0;
 
+	// The images are saved in capture order from the request on; the capture
+	// does not wait, so an image overwritten before being copied is lost.
+	FrameRing<image_data>::Reader saving(FrameRing<image_data>::EVERY);
+	vector<uint8_t> rawImage(imageBufferSize);
+	image_data imageData;
+	bool saveRequested = false;
+	int numLostImages = 0;
+
 	while (!terminateLoop) {
 
-		if (bufferRawReadable && saveImage) {
+		if (!saveRequested) {
+			if (saveRequests == 0) {
+				std::this_thread::sleep_for(milliseconds(1));
+				continue;
+			}
+			// The images captured after the key press
+			frameRing.skipToEnd(saving);
+			saveRequested = true;
+		}
+
+		uint64_t sequence;
+		if (!frameRing.next(saving, sequence)) {
+			std::this_thread::sleep_for(milliseconds(1));
+			continue;
+		}
+		if (!frameRing.read(sequence, rawImage.data(), imageData)) {
+			cout << "\t\tthread " << thread_id << ": Image overwritten before being saved" << endl;
+			numLostImages++;
+			continue;
+		}
+
+		{
 
 			cout << "\t\tthread " << thread_id << ": Start saving image number " << imageNum << endl;
 
-			int cameraIndex = 0;
+			int cameraIndex = imageData.cameraIdx;
 
 			// Write image file
 			ostringstream s1;
@@ -706,7 +710,7 @@ void* thSave (void *threadarg) {
 			// Save the raw image into file
 			ofstream myFile (imageName, ios::out | ios::binary);
 			if (myFile.is_open()) {
-				myFile.write ((char*)rawImageBuffer,imageBufferSize);
+				myFile.write ((char*)rawImage.data(),imageBufferSize);
 				myFile.close();
 			} else {
 				cout << "Error writing image file " << imageName << endl;
@@ -718,29 +722,30 @@ void* thSave (void *threadarg) {
 				ofstream myFile2(imageCfgName);
 				if (myFile2.is_open()) {
 					myFile2 << "Camera Index: "
-							<< (imageData[cameraIndex]).cameraIdx << "\n";
-					time_t my_time = (imageData[cameraIndex]).captureTime;
+							<< imageData.cameraIdx << "\n";
+					time_t my_time = imageData.captureTime;
 					myFile2 << "Capture Time: " << ctime(&my_time);
 					myFile2 << "Exposure Time: "
-							<< (imageData[cameraIndex]).exposureTime << "\n";
-					myFile2 << "Gain: " << (imageData[cameraIndex]).gain
+							<< imageData.exposureTime << "\n";
+					myFile2 << "Gain: " << imageData.gain
 							<< "\n";
 					myFile2 << "Balance Red  : "
-							<< (imageData[cameraIndex]).balanceR << "\n";
+							<< imageData.balanceR << "\n";
 					myFile2 << "Balance Green: "
-							<< (imageData[cameraIndex]).balanceG << "\n";
+							<< imageData.balanceG << "\n";
 					myFile2 << "Balance Blue : "
-							<< (imageData[cameraIndex]).balanceB << "\n";
+							<< imageData.balanceB << "\n";
 					myFile2 << "Auto Exposure Time Continuous: "
-							<< (imageData[cameraIndex]).autoExpTime << "\n";
+							<< imageData.autoExpTime << "\n";
 					myFile2 << "Auto Gain Continuous: "
-							<< (imageData[cameraIndex]).autoGain << "\n";
+							<< imageData.autoGain << "\n";
 					myFile2.close();
 
 					cout << "\t\tthread " << thread_id << ": Finished saving from buffer." << endl;
 					imageNum++;
 
-					saveImage = false;
+					if (--saveRequests == 0)
+						saveRequested = false;
 
 				} else {
 					cout << "Error writing image file " << imageCfgName << endl;
@@ -749,15 +754,11 @@ void* thSave (void *threadarg) {
 			}
 
 		}
-
-		cout << "\t\tthread " << thread_id << ": Barrier 1" << endl;
-		barrier_2 = 1;
-		pthread_barrier_wait(&thBarrier);
-		cout << "\t\tthread " << thread_id << ": Barrier 2" << endl;
-		barrier_2 = 2;
-		pthread_barrier_wait(&thBarrier);
 	}
 
+	if (numLostImages + saving.skipped > 0)
+		cout << "\t\tthread " << thread_id << ": " << numLostImages + saving.skipped
+				<< " images overwritten before being saved" << endl;
 
 	pthread_exit(NULL);
 }
@@ -0,0 +1,135 @@
+// frameRing.h
+/*
+   Preallocated ring of frame slots between one capture thread and any number
+   of consumer threads, without lock nor wait on either side.
+   The producer always writes the oldest slot, so the capture never waits for
+   a consumer. Each slot carries a version that is odd while the slot is being
+   written and 2 * sequence + 2 once the frame of that sequence is complete.
+   A consumer reads a frame optimistically and checks afterwards that the
+   version did not change (a seqlock), so a frame overwritten while it was
+   being read is detected and dropped instead of being used half written.
+   Each consumer keeps its own Reader: LATEST jumps to the newest frame, e.g.
+   for the preview, EVERY reads the frames in order, e.g. for the writer, and
+   only loses those the producer overwrote before they were read.
+*/
+
+#ifndef FRAMERING_H_
+#define FRAMERING_H_
+
+#include <atomic>
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+template<typename Meta>
+class FrameRing {
+public:
+	enum Policy { LATEST, EVERY };
+
+	// Position of one consumer in the ring
+	struct Reader {
+		Reader(Policy policy = LATEST) : policy(policy), cursor(0), skipped(0) {}
+		Policy policy;
+		uint64_t cursor;	// sequence of the next frame not seen yet
+		uint64_t skipped;	// frames passed over by next()
+	};
+
+	FrameRing(size_t slotCount, size_t frameSize) :
+			slots(slotCount < 3 ? 3 : slotCount), frameSize(frameSize), head(0) {
+		for (size_t i = 0; i < slots.size(); i++) {
+			slots[i].data = new uint8_t[frameSize];
+			// Touch the pages now rather than during the first captures
+			memset(slots[i].data, 0, frameSize);
+			slots[i].version.store(0);
+		}
+	}
+
+	~FrameRing() {
+		for (size_t i = 0; i < slots.size(); i++)
+			delete[] slots[i].data;
+	}
+
+	// Producer only: copies the frame into the oldest slot
+	void publish(const uint8_t *data, const Meta &meta) {
+		uint64_t sequence = head.load(std::memory_order_relaxed);
+		Slot &slot = slots[sequence % slots.size()];
+		slot.version.store(2 * sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(slot.data, data, frameSize);
+		slot.meta = meta;
+		slot.version.store(2 * sequence + 2, std::memory_order_release);
+		head.store(sequence + 1, std::memory_order_release);
+	}
+
+	// Number of frames published so far
+	uint64_t published() const {
+		return head.load(std::memory_order_acquire);
+	}
+
+	// Sequence of the next frame for the reader, false if there is none yet
+	bool next(Reader &reader, uint64_t &sequence) const {
+		uint64_t h = head.load(std::memory_order_acquire);
+		if (reader.cursor >= h)
+			return false;
+		if (reader.policy == LATEST) {
+			sequence = h - 1;
+		} else {
+			// The oldest slot is the next one to be rewritten, it is left out
+			uint64_t oldest = h > slots.size() - 1 ? h - (slots.size() - 1) : 0;
+			sequence = reader.cursor > oldest ? reader.cursor : oldest;
+		}
+		reader.skipped += sequence - reader.cursor;
+		reader.cursor = sequence + 1;
+		return true;
+	}
+
+	// The reader will only see the frames published from now on
+	void skipToEnd(Reader &reader) const {
+		reader.cursor = published();
+	}
+
+	// Copies the frame, false if it was overwritten before or during the copy
+	bool read(uint64_t sequence, uint8_t *data, Meta &meta) const {
+		const Slot &slot = slots[sequence % slots.size()];
+		if (slot.version.load(std::memory_order_acquire) != 2 * sequence + 2)
+			return false;
+		memcpy(data, slot.data, frameSize);
+		meta = slot.meta;
+		return valid(sequence);
+	}
+
+	// The frame in place, without copy, NULL if already overwritten. Whatever
+	// is computed from it holds only if valid() is still true afterwards.
+	const uint8_t *peek(uint64_t sequence) const {
+		const Slot &slot = slots[sequence % slots.size()];
+		if (slot.version.load(std::memory_order_acquire) != 2 * sequence + 2)
+			return NULL;
+		return slot.data;
+	}
+
+	// The frame was not overwritten since peek() or the start of read()
+	bool valid(uint64_t sequence) const {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return slots[sequence % slots.size()].version.load(std::memory_order_relaxed) == 2 * sequence + 2;
+	}
+
+	size_t size() const {
+		return slots.size();
+	}
+
+private:
+	struct Slot {
+		uint8_t *data;
+		Meta meta;
+		std::atomic<uint64_t> version;
+	};
+
+	FrameRing(const FrameRing&);
+	FrameRing& operator=(const FrameRing&);
+
+	std::vector<Slot> slots;
+	size_t frameSize;
+	std::atomic<uint64_t> head;	// sequence of the next frame to publish
+};
+
+#endif /* FRAMERING_H_ */